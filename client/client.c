@@ -0,0 +1,715 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <assert.h>
+#include <getopt.h>
+#include <liburing.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// load generator for the echo servers, drives N connections from one ring per
+// thread and reports in the same format as the results under bench/, with the
+// full latency distribution appended
+
+#define DEFAULT_PORT 9919
+#define DEFAULT_PAYLOAD 256
+#define DEFAULT_CONNS 8
+#define DEFAULT_DURATION (180ULL * 1000000000ULL) // 3m0s
+#define MAX_THREADS 256
+#define RECV_BUF_MIN (1024 * 64)
+
+// requests whose send time is remembered per connection, in stream mode any
+// request sent while the queue is full goes untimed
+#define TS_QUEUE 64
+
+// log-linear latency histogram in nanoseconds, values are kept to
+// HIST_SUB_BITS significant bits (< 1% error) across the whole u64 range
+#define HIST_SUB_BITS 7
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+#define MODE_STREAM 0
+#define MODE_REQ_RES 1
+
+#define EV_SEND 0
+#define EV_RECV 1
+#define EV_SHIFT 32
+
+#define LIKELY(x) __builtin_expect(!!(x), 1)
+#define UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+typedef struct {
+  uint64_t seq; // request number
+  uint64_t ts;  // when its first byte was queued for sending
+} timed_req_t;
+
+typedef struct {
+  int fd;
+  uint32_t soff;     // bytes of the current request already sent
+  uint32_t rpart;    // bytes of the current response already received
+  uint8_t sending;   // a send is outstanding
+  uint8_t receiving; // a recv is outstanding
+  uint8_t dead;      // the server closed the connection or an op failed
+  uint64_t req_seq;  // requests started
+  uint64_t resp_seq; // responses completed
+  uint64_t sent;     // bytes
+  uint64_t received; // bytes
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t lat_sum; // of the timed responses
+  uint64_t lat_count;
+  uint32_t ts_head; // timed requests in flight, oldest first
+  uint32_t ts_tail;
+  timed_req_t ts_q[TS_QUEUE];
+} client_conn_t;
+
+typedef struct {
+  pthread_t thread;
+  struct io_uring ring;
+  client_conn_t *conns; // this thread's share of the connections
+  uint32_t nconns;
+  unsigned char *sbuf; // payload, every connection sends the same bytes
+  unsigned char *rbuf; // echoes are drained into it and never looked at
+  uint32_t rbuf_size;
+  uint64_t hist[HIST_BUCKETS];
+  uint64_t lat_max;
+} worker_t;
+
+typedef struct {
+  struct sockaddr_in addr;
+  const char *host;
+  int port;
+  int mode;
+  uint32_t payload;
+  uint32_t conns;
+  int threads;
+  uint64_t duration; // ns
+} client_config_t;
+
+static client_config_t cfg = {.host = "127.0.0.1",
+                              .port = DEFAULT_PORT,
+                              .mode = MODE_STREAM,
+                              .payload = DEFAULT_PAYLOAD,
+                              .conns = DEFAULT_CONNS,
+                              .threads = 1,
+                              .duration = DEFAULT_DURATION};
+
+static pthread_barrier_t start_barrier;
+
+static void *worker_run(void *arg);
+
+static int conn_connect(void);
+
+static void conn_try_send(worker_t *w, uint32_t idx, uint64_t now);
+
+static void conn_add_recv(worker_t *w, uint32_t idx);
+
+static void on_send(worker_t *w, uint32_t idx, struct io_uring_cqe *cqe);
+
+static void on_recv(worker_t *w, uint32_t idx, struct io_uring_cqe *cqe);
+
+static struct io_uring_sqe *must_get_sqe(worker_t *w);
+
+static inline uint64_t now_ns(void);
+
+static inline uint32_t hist_index(uint64_t v);
+
+static inline uint64_t hist_value(uint32_t idx);
+
+static void hist_record(worker_t *w, uint64_t v);
+
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t count,
+                                uint64_t max, double p);
+
+static uint64_t parse_duration(const char *s);
+
+static const char *fmt_bytes(double v, char *buf, size_t len);
+
+static const char *fmt_duration(uint64_t ns, char *buf, size_t len);
+
+static uint32_t raise_nofile_limit(uint32_t want);
+
+static void print_report(worker_t *workers, client_conn_t *conns);
+
+// ---------------------------------------------------------------------
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -a address   server address (default 127.0.0.1)\n"
+          "  -p port      server port (default %d)\n"
+          "  -m mode      stream or req-res (default stream)\n"
+          "  -s bytes     payload size (default %d)\n"
+          "  -c conns     number of connections (default %d)\n"
+          "  -d duration  how long to run, e.g. 3m0s, 30s (default 3m0s)\n"
+          "  -t threads   number of threads, each with its own ring "
+          "(default 1)\n",
+          prog, DEFAULT_PORT, DEFAULT_PAYLOAD, DEFAULT_CONNS);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "a:p:m:s:c:d:t:h")) != -1) {
+    switch (opt) {
+    case 'a':
+      cfg.host = optarg;
+      break;
+    case 'p':
+      cfg.port = atoi(optarg);
+      break;
+    case 'm':
+      if (strcmp(optarg, "stream") == 0) {
+        cfg.mode = MODE_STREAM;
+      } else if (strcmp(optarg, "req-res") == 0) {
+        cfg.mode = MODE_REQ_RES;
+      } else {
+        fprintf(stderr, "unknown mode: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 's':
+      cfg.payload = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      cfg.conns = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      cfg.duration = parse_duration(optarg);
+      if (cfg.duration == 0) {
+        fprintf(stderr, "invalid duration: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 't':
+      cfg.threads = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (cfg.payload == 0 || cfg.conns == 0) {
+    fprintf(stderr, "payload and connections must be non-zero\n");
+    return EXIT_FAILURE;
+  }
+  if (cfg.threads < 1 || cfg.threads > MAX_THREADS) {
+    fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+  if ((uint32_t)cfg.threads > cfg.conns) {
+    cfg.threads = cfg.conns;
+  }
+
+  memset(&cfg.addr, 0, sizeof cfg.addr);
+  cfg.addr.sin_family = AF_INET;
+  cfg.addr.sin_port = htons(cfg.port);
+  if (inet_pton(AF_INET, cfg.host, &cfg.addr.sin_addr) != 1) {
+    fprintf(stderr, "invalid address: %s\n", cfg.host);
+    return EXIT_FAILURE;
+  }
+
+  if (raise_nofile_limit(cfg.conns + 64) < cfg.conns + 64) {
+    fprintf(stderr, "RLIMIT_NOFILE is too low for %u connections\n",
+            cfg.conns);
+    return EXIT_FAILURE;
+  }
+
+  // connect everything up front so that connection setup is not measured
+  client_conn_t *conns = calloc(cfg.conns, sizeof *conns);
+  assert(conns != NULL);
+  for (uint32_t i = 0; i < cfg.conns; ++i) {
+    conns[i].fd = conn_connect();
+    if (conns[i].fd < 0) {
+      fprintf(stderr, "connect %s:%d: %s\n", cfg.host, cfg.port,
+              strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+
+  worker_t *workers = calloc(cfg.threads, sizeof *workers);
+  assert(workers != NULL);
+  assert(pthread_barrier_init(&start_barrier, NULL, cfg.threads) == 0);
+
+  uint32_t start = 0;
+  for (int i = 0; i < cfg.threads; ++i) {
+    worker_t *w = &workers[i];
+    w->nconns = cfg.conns / cfg.threads + ((uint32_t)i < cfg.conns % cfg.threads);
+    w->conns = conns + start;
+    start += w->nconns;
+    assert(pthread_create(&w->thread, NULL, worker_run, w) == 0);
+  }
+
+  for (int i = 0; i < cfg.threads; ++i) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  print_report(workers, conns);
+
+  for (uint32_t i = 0; i < cfg.conns; ++i) {
+    close(conns[i].fd);
+  }
+  free(workers);
+  free(conns);
+  return 0;
+}
+
+static int conn_connect(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (connect(fd, (const struct sockaddr *)&cfg.addr, sizeof cfg.addr) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+  return fd;
+}
+
+static void *worker_run(void *arg) {
+  worker_t *w = arg;
+
+  // every connection has at most one send and one recv outstanding, a cq of
+  // twice the connection count can't overflow
+  struct io_uring_params params;
+  memset(&params, 0, sizeof params);
+  params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_DEFER_TASKRUN |
+                 IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_CQSIZE |
+                 IORING_SETUP_CLAMP;
+  params.cq_entries = w->nconns * 2;
+  uint32_t sq_depth = w->nconns * 2 < 4096 ? w->nconns * 2 : 4096;
+  assert(io_uring_queue_init_params(sq_depth, &w->ring, &params) == 0);
+
+  w->sbuf = malloc(cfg.payload);
+  w->rbuf_size = cfg.payload > RECV_BUF_MIN ? cfg.payload : RECV_BUF_MIN;
+  w->rbuf = malloc(w->rbuf_size);
+  assert(w->sbuf != NULL && w->rbuf != NULL);
+  for (uint32_t i = 0; i < cfg.payload; ++i) {
+    w->sbuf[i] = 'a' + i % 26;
+  }
+
+  pthread_barrier_wait(&start_barrier);
+
+  uint64_t now = now_ns();
+  uint64_t deadline = now + cfg.duration;
+  for (uint32_t i = 0; i < w->nconns; ++i) {
+    conn_add_recv(w, i);
+    conn_try_send(w, i, now);
+  }
+
+  while ((now = now_ns()) < deadline) {
+    // wake up at least every 100ms to notice the deadline
+    uint64_t left = deadline - now;
+    if (left > 100000000ULL) {
+      left = 100000000ULL;
+    }
+    struct __kernel_timespec ts = {.tv_sec = left / 1000000000ULL,
+                                   .tv_nsec = left % 1000000000ULL};
+    struct io_uring_cqe *cqe;
+    int ret = io_uring_submit_and_wait_timeout(&w->ring, &cqe, 1, &ts, NULL);
+    // EAGAIN and EBUSY are transient, the CQEs below make room
+    if (UNLIKELY(ret < 0) && ret != -ETIME && ret != -EINTR &&
+        ret != -EAGAIN && ret != -EBUSY) {
+      fprintf(stderr, "io_uring_submit_and_wait_timeout: %s\n",
+              strerror(-ret));
+      exit(1);
+    }
+
+    unsigned head;
+    unsigned i = 0;
+    io_uring_for_each_cqe(&w->ring, head, cqe) {
+      ++i;
+      uint64_t ctx = io_uring_cqe_get_data64(cqe);
+      uint32_t idx = (uint32_t)ctx;
+      if ((ctx >> EV_SHIFT) == EV_SEND) {
+        on_send(w, idx, cqe);
+      } else {
+        on_recv(w, idx, cqe);
+      }
+    }
+    io_uring_cq_advance(&w->ring, i);
+  }
+
+  // outstanding ops die with the ring, the sockets are closed by main
+  io_uring_queue_exit(&w->ring);
+  free(w->sbuf);
+  free(w->rbuf);
+  return NULL;
+}
+
+static struct io_uring_sqe *must_get_sqe(worker_t *w) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&w->ring);
+  if (!sqe) {
+    io_uring_submit(&w->ring);
+    sqe = io_uring_get_sqe(&w->ring);
+    assert(sqe != NULL);
+  }
+  return sqe;
+}
+
+// in req-res mode the next request only goes out once the previous response
+// is in, in stream mode the connection sends back to back
+static void conn_try_send(worker_t *w, uint32_t idx, uint64_t now) {
+  client_conn_t *c = &w->conns[idx];
+  if (c->sending || c->dead) {
+    return;
+  }
+
+  if (c->soff == 0) {
+    if (cfg.mode == MODE_REQ_RES && c->req_seq != c->resp_seq) {
+      return;
+    }
+
+    if (c->ts_tail - c->ts_head < TS_QUEUE) {
+      timed_req_t *t = &c->ts_q[c->ts_tail++ % TS_QUEUE];
+      t->seq = c->req_seq;
+      t->ts = now;
+    }
+    c->req_seq++;
+  }
+
+  struct io_uring_sqe *sqe = must_get_sqe(w);
+  io_uring_prep_send(sqe, c->fd, w->sbuf + c->soff, cfg.payload - c->soff,
+                     MSG_NOSIGNAL);
+  io_uring_sqe_set_data64(sqe, ((uint64_t)EV_SEND << EV_SHIFT) | idx);
+  c->sending = 1;
+}
+
+static void conn_add_recv(worker_t *w, uint32_t idx) {
+  client_conn_t *c = &w->conns[idx];
+  struct io_uring_sqe *sqe = must_get_sqe(w);
+  io_uring_prep_recv(sqe, c->fd, w->rbuf, w->rbuf_size, 0);
+  io_uring_sqe_set_data64(sqe, ((uint64_t)EV_RECV << EV_SHIFT) | idx);
+  c->receiving = 1;
+}
+
+static void conn_fail(worker_t *w, uint32_t idx, const char *op, int res) {
+  client_conn_t *c = &w->conns[idx];
+  if (!c->dead) {
+    fprintf(stderr, "%s on connection fd %d: %s\n", op, c->fd,
+            res ? strerror(-res) : "closed by server");
+  }
+  c->dead = 1;
+}
+
+static void on_send(worker_t *w, uint32_t idx, struct io_uring_cqe *cqe) {
+  client_conn_t *c = &w->conns[idx];
+  c->sending = 0;
+  if (UNLIKELY(cqe->res <= 0)) {
+    conn_fail(w, idx, "send", cqe->res);
+    return;
+  }
+
+  c->sent += cqe->res;
+  c->soff += cqe->res;
+  if (c->soff == cfg.payload) {
+    c->soff = 0;
+    c->requests++;
+  }
+  conn_try_send(w, idx, now_ns());
+}
+
+static void on_recv(worker_t *w, uint32_t idx, struct io_uring_cqe *cqe) {
+  client_conn_t *c = &w->conns[idx];
+  c->receiving = 0;
+  if (UNLIKELY(cqe->res <= 0)) {
+    conn_fail(w, idx, "recv", cqe->res);
+    return;
+  }
+
+  uint64_t now = now_ns();
+  c->received += cqe->res;
+  c->rpart += cqe->res;
+  while (c->rpart >= cfg.payload) {
+    c->rpart -= cfg.payload;
+    if (c->ts_head != c->ts_tail &&
+        c->ts_q[c->ts_head % TS_QUEUE].seq == c->resp_seq) {
+      uint64_t lat = now - c->ts_q[c->ts_head++ % TS_QUEUE].ts;
+      c->lat_sum += lat;
+      c->lat_count++;
+      hist_record(w, lat);
+    }
+    c->resp_seq++;
+    c->responses++;
+  }
+
+  conn_add_recv(w, idx);
+  conn_try_send(w, idx, now);
+}
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// values below HIST_SUB get a bucket each, above that every power of two is
+// split into HIST_SUB buckets
+static inline uint32_t hist_index(uint64_t v) {
+  if (v < HIST_SUB) {
+    return v;
+  }
+  int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB + (uint32_t)((v >> shift) - HIST_SUB);
+}
+
+// lowest value that lands in bucket idx
+static inline uint64_t hist_value(uint32_t idx) {
+  if (idx < HIST_SUB) {
+    return idx;
+  }
+  uint32_t shift = idx / HIST_SUB - 1;
+  return ((uint64_t)(idx % HIST_SUB) + HIST_SUB) << shift;
+}
+
+static void hist_record(worker_t *w, uint64_t v) {
+  w->hist[hist_index(v)]++;
+  if (v > w->lat_max) {
+    w->lat_max = v;
+  }
+}
+
+// reports the highest value of the bucket the percentile falls into, like
+// HdrHistogram does
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t count,
+                                uint64_t max, double p) {
+  if (count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(p / 100.0 * count + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < HIST_BUCKETS; ++i) {
+    seen += hist[i];
+    if (seen >= rank) {
+      uint64_t v = i + 1 < HIST_BUCKETS ? hist_value(i + 1) - 1 : max;
+      return v < max ? v : max;
+    }
+  }
+  return max;
+}
+
+// accepts go style durations such as 3m0s, 1m30s, 500ms or plain seconds,
+// returns 0 if the string doesn't parse
+static uint64_t parse_duration(const char *s) {
+  uint64_t total = 0;
+  while (*s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) {
+      return 0;
+    }
+
+    uint64_t unit;
+    if (*end == '\0' || strncmp(end, "s", 1) == 0) {
+      unit = 1000000000ULL;
+    } else if (strncmp(end, "ms", 2) == 0) {
+      unit = 1000000ULL;
+    } else if (*end == 'm') {
+      unit = 60ULL * 1000000000ULL;
+    } else if (*end == 'h') {
+      unit = 3600ULL * 1000000000ULL;
+    } else {
+      return 0;
+    }
+
+    total += (uint64_t)(v * unit);
+    s = end + (*end == '\0' ? 0 : (unit == 1000000ULL ? 2 : 1));
+  }
+  return total;
+}
+
+// decimal units with one digit after the point, e.g. 256 B, 4.1 kB, 1.1 GB
+static const char *fmt_bytes(double v, char *buf, size_t len) {
+  static const char *units[] = {"B", "kB", "MB", "GB", "TB", "PB"};
+  if (v < 1000) {
+    snprintf(buf, len, "%.0f B", v);
+    return buf;
+  }
+
+  int u = 0;
+  while (v >= 1000 && u < 5) {
+    v /= 1000;
+    u++;
+  }
+  snprintf(buf, len, "%.1f %s", v, units[u]);
+  return buf;
+}
+
+// appends whole.frac with trailing zeros dropped from the fraction
+static int fmt_fixed(char *buf, size_t len, uint64_t whole, uint64_t frac,
+                     int digits, const char *unit) {
+  char f[32] = "";
+  if (frac) {
+    snprintf(f, sizeof f, ".%0*lu", digits, frac);
+    size_t n = strlen(f);
+    while (f[n - 1] == '0') {
+      f[--n] = '\0';
+    }
+  }
+  return snprintf(buf, len, "%lu%s%s", whole, f, unit);
+}
+
+// formats like go's time.Duration, e.g. 20.274µs, 1.246378ms, 3m0s
+static const char *fmt_duration(uint64_t ns, char *buf, size_t len) {
+  if (ns == 0) {
+    snprintf(buf, len, "0s");
+  } else if (ns < 1000) {
+    snprintf(buf, len, "%luns", ns);
+  } else if (ns < 1000000) {
+    fmt_fixed(buf, len, ns / 1000, ns % 1000, 3, "µs");
+  } else if (ns < 1000000000) {
+    fmt_fixed(buf, len, ns / 1000000, ns % 1000000, 6, "ms");
+  } else {
+    uint64_t secs = ns / 1000000000;
+    int n = 0;
+    if (secs >= 3600) {
+      n += snprintf(buf, len, "%luh", secs / 3600);
+    }
+    if (secs >= 60) {
+      n += snprintf(buf + n, len - n, "%lum", secs / 60 % 60);
+    }
+    fmt_fixed(buf + n, len - n, secs % 60, ns % 1000000000, 9, "s");
+  }
+  return buf;
+}
+
+static uint32_t raise_nofile_limit(uint32_t want) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+    return want;
+  }
+
+  if (rl.rlim_cur < want) {
+    rl.rlim_cur = rl.rlim_max < want ? rl.rlim_max : want;
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+      getrlimit(RLIMIT_NOFILE, &rl);
+    }
+  }
+
+  return rl.rlim_cur < want ? (uint32_t)rl.rlim_cur : want;
+}
+
+// same layout as the reports under bench/, the latency percentiles are
+// appended after the existing totals
+static void print_report(worker_t *workers, client_conn_t *conns) {
+  char b1[32], b2[32], b3[32], b4[32], b5[32];
+  double secs = cfg.duration / 1e9;
+
+  printf("--------------------------------\n");
+  printf("address: %s:%d\tmode: %s\tpayload: %s\tduration: %s\tconnections: "
+         "%u\n",
+         cfg.host, cfg.port, cfg.mode == MODE_STREAM ? "stream" : "req-res",
+         fmt_bytes(cfg.payload, b1, sizeof b1),
+         fmt_duration(cfg.duration, b2, sizeof b2), cfg.conns);
+  printf("Connection metrics:\n");
+
+  uint64_t sent = 0, received = 0, requests = 0, responses = 0;
+  uint64_t lat_sum = 0, lat_count = 0;
+  for (uint32_t i = 0; i < cfg.conns; ++i) {
+    client_conn_t *c = &conns[i];
+    printf("[Conn %u] sent: %s, received: %s, requests: %lu, responses: %lu "
+           "sent/sec: %s recv/sec %s req/sec: %lu res/sec %lu",
+           i + 1, fmt_bytes(c->sent, b1, sizeof b1),
+           fmt_bytes(c->received, b2, sizeof b2), c->requests, c->responses,
+           fmt_bytes(c->sent / secs, b3, sizeof b3),
+           fmt_bytes(c->received / secs, b4, sizeof b4),
+           (uint64_t)(c->requests / secs), (uint64_t)(c->responses / secs));
+    if (cfg.mode == MODE_REQ_RES) {
+      printf(" avg-res-time: %s",
+             fmt_duration(c->lat_count ? c->lat_sum / c->lat_count : 0, b5,
+                          sizeof b5));
+    }
+    printf("\n");
+
+    sent += c->sent;
+    received += c->received;
+    requests += c->requests;
+    responses += c->responses;
+    lat_sum += c->lat_sum;
+    lat_count += c->lat_count;
+  }
+
+  static uint64_t hist[HIST_BUCKETS];
+  uint64_t max = 0;
+  for (int t = 0; t < cfg.threads; ++t) {
+    for (uint32_t i = 0; i < HIST_BUCKETS; ++i) {
+      hist[i] += workers[t].hist[i];
+    }
+    if (workers[t].lat_max > max) {
+      max = workers[t].lat_max;
+    }
+  }
+
+  printf("--------------------------------\n\n");
+  printf("total-sent/second:              %s\n",
+         fmt_bytes(sent / secs, b1, sizeof b1));
+  printf("total-received/second:          %s\n",
+         fmt_bytes(received / secs, b1, sizeof b1));
+  printf("total-requests/second:          %lu\n", (uint64_t)(requests / secs));
+  printf("total-responses/second:         %lu\n",
+         (uint64_t)(responses / secs));
+  printf("total-bytes-sent:               %s \n",
+         fmt_bytes(sent, b1, sizeof b1));
+  printf("total-bytes-received:           %s \n",
+         fmt_bytes(received, b1, sizeof b1));
+  printf("total-requests-sent:            %lu \n", requests);
+  printf("total-responses-received:       %lu\n", responses);
+  if (cfg.mode == MODE_REQ_RES) {
+    printf("avg-response-time:           %s\n",
+           fmt_duration(lat_count ? lat_sum / lat_count : 0, b1, sizeof b1));
+  }
+
+  static const struct {
+    const char *label;
+    double p;
+  } pcts[] = {{"p50-response-time:", 50},
+              {"p99-response-time:", 99},
+              {"p99.9-response-time:", 99.9}};
+  for (size_t i = 0; i < sizeof pcts / sizeof pcts[0]; ++i) {
+    printf("%-29s%s\n", pcts[i].label,
+           fmt_duration(hist_percentile(hist, lat_count, max, pcts[i].p), b1,
+                        sizeof b1));
+  }
+  printf("%-29s%s\n", "max-response-time:", fmt_duration(max, b1, sizeof b1));
+}
@@ -0,0 +1,130 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#ifndef COMMON_ARENA_H
+#define COMMON_ARENA_H
+
+// anonymous mappings for the servers' buffer arenas. ARENA_HUGE backs an
+// arena by explicit huge pages from the pool reserved in
+// /proc/sys/vm/nr_hugepages, or, when too few are reserved, by transparent
+// huge pages on a 2 MB aligned mapping. ARENA_NUMA binds the arena to the
+// numa node of the cpu the caller runs on, so it only makes sense for a
+// pinned caller, and it has to happen before the first touch. mbind and
+// getcpu are raw syscalls, libnuma is not needed. MAP_HUGETLB, MADV_HUGEPAGE
+// and MAP_NORESERVE need _GNU_SOURCE, defined by the including file.
+
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define ARENA_HUGE 1      // back the arena by huge pages
+#define ARENA_NUMA 2      // bind the arena to the caller's numa node
+#define ARENA_NORESERVE 4 // reserved address space, populated on demand
+
+#define ARENA_HUGE_PAGE (2UL << 20) // default huge page size on x86 and arm64
+#define ARENA_MAX_NODES 1024
+
+// MPOL_BIND for pages that can be reclaimed, explicit huge pages come out of
+// a pool that is shared by all nodes and a bound fault would SIGBUS once the
+// node's share ran out, so they only prefer the node
+static inline void arena_bind_local(void *p, size_t len, int mode) {
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 ||
+      node >= ARENA_MAX_NODES) {
+    return;
+  }
+  unsigned long mask[ARENA_MAX_NODES / (8 * sizeof(unsigned long))];
+  memset(mask, 0, sizeof mask);
+  mask[node / (8 * sizeof mask[0])] = 1UL << (node % (8 * sizeof mask[0]));
+  // maxnode counts one past the last bit the kernel reads
+  if (syscall(SYS_mbind, p, len, mode, mask, ARENA_MAX_NODES + 1, 0) != 0) {
+    static int warned;
+    if (!__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+      fprintf(stderr, "[warning]: mbind to node %u failed: %s\n", node,
+              strerror(errno));
+    }
+  }
+}
+
+// returns the arena or MAP_FAILED. an explicit huge page arena is reserved in
+// full up front, so it never faults on an empty pool, even if the caller
+// asked for ARENA_NORESERVE
+static inline void *arena_map(size_t len, int flags) {
+  void *p;
+  if (flags & ARENA_HUGE) {
+    size_t huge_len = (len + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+    p = mmap(NULL, huge_len, PROT_READ | PROT_WRITE,
+             MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      if (flags & ARENA_NUMA) {
+        arena_bind_local(p, huge_len, MPOL_PREFERRED);
+      }
+      return p;
+    }
+    static int warned;
+    if (!__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+      fprintf(stderr,
+              "[warning]: no huge pages reserved (%s), falling back to "
+              "transparent huge pages\n",
+              strerror(errno));
+    }
+  }
+
+  // a transparent huge page needs a 2 MB aligned range, the mapping is made
+  // a huge page larger and the unaligned ends are unmapped again
+  size_t pad = 0;
+  if (flags & ARENA_HUGE) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    len = (len + page - 1) & ~(page - 1);
+    pad = ARENA_HUGE_PAGE;
+  }
+  p = mmap(NULL, len + pad, PROT_READ | PROT_WRITE,
+           MAP_ANON | MAP_PRIVATE |
+               ((flags & ARENA_NORESERVE) ? MAP_NORESERVE : 0),
+           -1, 0);
+  if (p == MAP_FAILED) {
+    return p;
+  }
+  if (pad) {
+    uintptr_t start = (uintptr_t)p;
+    uintptr_t aligned = (start + pad - 1) & ~(uintptr_t)(pad - 1);
+    if (aligned > start) {
+      munmap(p, aligned - start);
+    }
+    munmap((void *)(aligned + len), pad - (aligned - start));
+    p = (void *)aligned;
+    madvise(p, len, MADV_HUGEPAGE);
+  }
+  if (flags & ARENA_NUMA) {
+    arena_bind_local(p, len, MPOL_BIND);
+  }
+  return p;
+}
+
+#endif
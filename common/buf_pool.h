@@ -0,0 +1,78 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#ifndef COMMON_BUF_POOL_H
+#define COMMON_BUF_POOL_H
+
+// fixed size buffers, carved from chunks of n buffers that are mapped on
+// demand and never returned while the worker runs. a free buffer stores the
+// next free buffer in its first bytes, so the pool needs no memory of its
+// own. a pool belongs to one worker and is never shared, so nothing here is
+// atomic.
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+typedef struct {
+  unsigned char *free; // first free buffer, NULL when all are taken
+  size_t size;         // bytes per buffer, at least a pointer
+  int n;               // buffers per chunk
+  int flags;           // arena flags of the chunks
+} buf_pool_t;
+
+static inline void buf_pool_init(buf_pool_t *p, size_t size, int n,
+                                 int flags) {
+  p->free = NULL;
+  p->size = size;
+  p->n = n;
+  p->flags = flags;
+}
+
+static inline void buf_pool_put(buf_pool_t *p, unsigned char *buf) {
+  memcpy(buf, &p->free, sizeof p->free);
+  p->free = buf;
+}
+
+// returns a buffer, or NULL if another chunk can't be mapped
+static inline unsigned char *buf_pool_get(buf_pool_t *p) {
+  if (!p->free) {
+    unsigned char *chunk = arena_map((size_t)p->n * p->size, p->flags);
+    if (chunk == MAP_FAILED) {
+      return NULL;
+    }
+
+    for (int i = 0; i < p->n; ++i) {
+      buf_pool_put(p, chunk + ((size_t)i * p->size));
+    }
+  }
+
+  unsigned char *buf = p->free;
+  memcpy(&p->free, buf, sizeof p->free);
+  return buf;
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#ifndef COMMON_CPU_H
+#define COMMON_CPU_H
+
+// cpu lists and worker pinning for the -c style options of the servers.
+// pthread_setaffinity_np and the CPU_* macros need _GNU_SOURCE, defined by
+// the including file.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// parses a cpu list such as "0,2,4-7" into cpus, returns the number of cpus
+// parsed or -1 if the list is malformed
+static inline int parse_cpu_list(const char *list, int *cpus, int max) {
+  int n = 0;
+  const char *p = list;
+  while (*p) {
+    char *end;
+    long lo = strtol(p, &end, 10);
+    if (end == p || lo < 0) {
+      return -1;
+    }
+    long hi = lo;
+    p = end;
+    if (*p == '-') {
+      hi = strtol(++p, &end, 10);
+      if (end == p || hi < lo) {
+        return -1;
+      }
+      p = end;
+    }
+
+    for (long cpu = lo; cpu <= hi; ++cpu) {
+      if (n == max) {
+        return -1;
+      }
+      cpus[n++] = (int)cpu;
+    }
+
+    if (*p == ',') {
+      ++p;
+    } else if (*p) {
+      return -1;
+    }
+  }
+
+  return n;
+}
+
+// pins the calling thread, a failure only warns, the worker still runs
+static inline void pin_to_cpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+  if (ret != 0) {
+    fprintf(stderr, "[warning]: failed to pin to cpu %d: %s\n", cpu,
+            strerror(ret));
+  }
+}
+
+#endif
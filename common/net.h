@@ -0,0 +1,80 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#ifndef COMMON_NET_H
+#define COMMON_NET_H
+
+// listening sockets for the readiness based servers, epoll.c and hybrid.c.
+// the listener is non-blocking, accepts drain it until EAGAIN.
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+// returns the listening socket, or a negative value with errno set.
+// reuseport lets every worker bind a listener of its own to the same port
+static inline int socket_bind_listen(uint16_t port, uint16_t addr, int backlog,
+                                     int reuseport) {
+  int server_fd;
+  struct sockaddr_in srv_addr;
+  int ret;
+
+  server_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (server_fd < 0) {
+    return server_fd;
+  }
+
+  int on = 1;
+  ret = setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int));
+  if (ret < 0) {
+    return ret;
+  }
+
+  if (reuseport) {
+    ret = setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(int));
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  memset(&srv_addr, 0, sizeof(srv_addr));
+  srv_addr.sin_family = AF_INET;
+  srv_addr.sin_port = htons(port);
+  srv_addr.sin_addr.s_addr = htons(addr);
+
+  ret = bind(server_fd, (const struct sockaddr *)&srv_addr, sizeof(srv_addr));
+  if (ret < 0) {
+    return ret;
+  }
+
+  ret = listen(server_fd, backlog);
+  if (ret < 0) {
+    return ret;
+  }
+
+  return server_fd;
+}
+
+#endif
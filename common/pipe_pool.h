@@ -0,0 +1,72 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#ifndef COMMON_PIPE_POOL_H
+#define COMMON_PIPE_POOL_H
+
+// pipes for the splice echo path. every connection moves its bytes through a
+// pipe of its own, socket -> pipe -> socket, and the pipes of closed
+// connections are kept for the next ones instead of being closed and
+// recreated. a pool belongs to one worker and is never shared, so nothing
+// here is atomic. the pipes are blocking, a reader that must not block passes
+// SPLICE_F_NONBLOCK. pipe2 needs _GNU_SOURCE, defined by the including file.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PIPE_POOL_MAX 1024 // idle pipes kept per worker, the rest are closed
+#define PIPE_SIZE (1 << 16) // default pipe capacity, the most a splice moves
+
+typedef struct {
+  int fds[PIPE_POOL_MAX][2];
+  uint32_t n;
+} pipe_pool_t;
+
+// hands out an empty pipe, fds[0] is the read end. returns -1 with errno set
+// if a new pipe can't be created
+static inline int pipe_pool_get(pipe_pool_t *p, int fds[2]) {
+  if (p->n > 0) {
+    --p->n;
+    fds[0] = p->fds[p->n][0];
+    fds[1] = p->fds[p->n][1];
+    return 0;
+  }
+  return pipe2(fds, O_CLOEXEC);
+}
+
+// takes a pipe back, a pipe that still holds data is closed instead
+static inline void pipe_pool_put(pipe_pool_t *p, int fds[2], int empty) {
+  if (empty && p->n < PIPE_POOL_MAX) {
+    p->fds[p->n][0] = fds[0];
+    p->fds[p->n][1] = fds[1];
+    ++p->n;
+    return;
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+#endif
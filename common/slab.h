@@ -0,0 +1,115 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#ifndef COMMON_SLAB_H
+#define COMMON_SLAB_H
+
+// connection tables. a slab hands out fixed size slots addressed by a 32 bit
+// index instead of a pointer or an fd, so a slot fits in an epoll or io_uring
+// context next to other bits. the slab grows by SLAB_CHUNK slots at a time
+// and its chunks are only unmapped by slab_destroy, a slot never moves. a free
+// slot links to the next free one through a uint32_t field of its own, at
+// link_off, the rest of the slot is left as it was. a slab belongs to one
+// worker and is never shared, so nothing here is atomic.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+#define SLAB_CHUNK 1024      // slots per chunk
+#define SLAB_MAX_CHUNKS 4096 // upto 4M slots per slab
+#define SLAB_NONE UINT32_MAX
+
+typedef struct {
+  unsigned char *chunks[SLAB_MAX_CHUNKS];
+  uint32_t nchunks;
+  uint32_t free;     // first unused slot, SLAB_NONE when all are taken
+  uint32_t size;     // bytes per slot
+  uint32_t link_off; // offset of the free list link in a slot
+  int flags;         // arena flags of the chunks
+} slab_t;
+
+static inline void slab_init(slab_t *sl, uint32_t size, uint32_t link_off,
+                             int flags) {
+  sl->nchunks = 0;
+  sl->free = SLAB_NONE;
+  sl->size = size;
+  sl->link_off = link_off;
+  sl->flags = flags;
+}
+
+static inline void *slab_get(slab_t *sl, uint32_t idx) {
+  return sl->chunks[idx / SLAB_CHUNK] + (size_t)(idx % SLAB_CHUNK) * sl->size;
+}
+
+static inline void slab_link(slab_t *sl, uint32_t idx, uint32_t next) {
+  memcpy((unsigned char *)slab_get(sl, idx) + sl->link_off, &next,
+         sizeof next);
+}
+
+// returns an unused slot, mapping another chunk when all slots are taken, or
+// SLAB_NONE if the slab is full or the chunk can't be mapped
+static inline uint32_t slab_alloc(slab_t *sl) {
+  if (sl->free == SLAB_NONE) {
+    if (sl->nchunks == SLAB_MAX_CHUNKS) {
+      return SLAB_NONE;
+    }
+
+    unsigned char *chunk = arena_map((size_t)SLAB_CHUNK * sl->size, sl->flags);
+    if (chunk == MAP_FAILED) {
+      return SLAB_NONE;
+    }
+
+    uint32_t base = sl->nchunks * SLAB_CHUNK;
+    sl->chunks[sl->nchunks++] = chunk;
+    for (uint32_t i = 0; i < SLAB_CHUNK; ++i) {
+      slab_link(sl, base + i, i + 1 < SLAB_CHUNK ? base + i + 1 : SLAB_NONE);
+    }
+    sl->free = base;
+  }
+
+  uint32_t idx = sl->free;
+  memcpy(&sl->free, (unsigned char *)slab_get(sl, idx) + sl->link_off,
+         sizeof sl->free);
+  return idx;
+}
+
+static inline void slab_free(slab_t *sl, uint32_t idx) {
+  slab_link(sl, idx, sl->free);
+  sl->free = idx;
+}
+
+// slots that are still taken at this point simply go away with the chunks
+static inline void slab_destroy(slab_t *sl) {
+  for (uint32_t i = 0; i < sl->nchunks; ++i) {
+    munmap(sl->chunks[i], (size_t)SLAB_CHUNK * sl->size);
+  }
+  sl->nchunks = 0;
+  sl->free = SLAB_NONE;
+}
+
+#endif
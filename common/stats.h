@@ -0,0 +1,128 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#ifndef COMMON_STATS_H
+#define COMMON_STATS_H
+
+// hot path instrumentation shared by the servers. counters and histograms
+// live in each worker's own state and are only ever touched by that worker,
+// so nothing here is atomic. built with -DSERVER_STATS (make ... STATS=1),
+// otherwise every STATS_* macro expands to nothing and the arguments are
+// never evaluated.
+//
+// a SIGUSR1 bumps stats_dump_gen, every worker notices the change on its next
+// loop iteration and writes a snapshot of its own stats to stderr
+
+#ifdef SERVER_STATS
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// bucket i counts values in [2^(i-1), 2^i), bucket 0 counts zeros
+#define STATS_HIST_BUCKETS 65
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[STATS_HIST_BUCKETS];
+} stats_hist_t;
+
+static volatile sig_atomic_t stats_dump_gen;
+
+static void stats_on_signal(int sig) {
+  (void)sig;
+  stats_dump_gen++;
+}
+
+// no SA_RESTART, a worker blocked in its wait call returns with EINTR and
+// dumps right away, the others dump when their next event comes in
+static inline void stats_install_handler(void) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = stats_on_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+}
+
+static inline uint64_t stats_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void stats_hist_add(stats_hist_t *h, uint64_t v) {
+  h->count++;
+  h->sum += v;
+  if (v > h->max) {
+    h->max = v;
+  }
+  h->buckets[v ? 64 - __builtin_clzll(v) : 0]++;
+}
+
+// upper bound of the bucket holding the p-th percentile
+static inline uint64_t stats_hist_percentile(const stats_hist_t *h, double p) {
+  uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+  uint64_t seen = 0;
+  for (int i = 0; i < STATS_HIST_BUCKETS; ++i) {
+    seen += h->buckets[i];
+    if (seen >= rank && seen) {
+      uint64_t bound = i ? (i < 64 ? (1ULL << i) - 1 : UINT64_MAX) : 0;
+      return bound < h->max ? bound : h->max;
+    }
+  }
+  return h->max;
+}
+
+static inline void stats_hist_print(FILE *f, const char *name,
+                                    const stats_hist_t *h) {
+  if (!h->count) {
+    fprintf(f, "  %-20s n=0\n", name);
+    return;
+  }
+  fprintf(f, "  %-20s n=%lu avg=%.1f p50<=%lu p99<=%lu max=%lu\n", name,
+          h->count, (double)h->sum / h->count, stats_hist_percentile(h, 50),
+          stats_hist_percentile(h, 99), h->max);
+}
+
+#define STATS_INC(c) ((c)++)
+#define STATS_ADD(c, n) ((c) += (n))
+#define STATS_HIST(h, v) stats_hist_add(&(h), (v))
+#define STATS_TIME_START(t) uint64_t t = stats_now_ns()
+#define STATS_TIME_END(h, t) stats_hist_add(&(h), stats_now_ns() - (t))
+
+#else
+
+#define STATS_INC(c) ((void)0)
+#define STATS_ADD(c, n) ((void)0)
+#define STATS_HIST(h, v) ((void)0)
+#define STATS_TIME_START(t) ((void)0)
+#define STATS_TIME_END(h, t) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,160 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#ifndef COMMON_TIMER_WHEEL_H
+#define COMMON_TIMER_WHEEL_H
+
+// hierarchical timer wheel for the idle connection timeouts. TW_LEVELS
+// wheels of TW_SLOTS slots each, level n slots are TW_SLOTS^n ticks wide.
+// a timer is linked into the slot its expiry falls in, so arming and
+// cancelling are O(1), and every TW_SLOTS ticks the next level's current
+// slot is spread out over the levels below it. timers are embedded in the
+// connections, a wheel belongs to one worker and nothing here is atomic.
+// a tick is whatever the owner makes it, the wheel only counts them.
+// a zeroed wheel is an empty wheel at tick 0.
+
+#include <stdint.h>
+
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4
+#define TW_RANGE (1ULL << (TW_BITS * TW_LEVELS)) // furthest a timer can be out
+
+typedef struct tw_timer {
+  struct tw_timer *next;
+  struct tw_timer **pprev; // link pointing at this timer, NULL while unarmed
+  uint64_t expires;        // tick the timer is due at
+  uint32_t owner;          // connection the timer belongs to
+} tw_timer_t;
+
+typedef struct {
+  tw_timer_t *slots[TW_LEVELS][TW_SLOTS];
+  uint64_t now;   // ticks advanced so far
+  uint32_t armed; // timers in the wheel
+} tw_wheel_t;
+
+// called for every timer that expires, the timer is unarmed by then and may
+// be armed again
+typedef void (*tw_expire_cb)(void *arg, tw_timer_t *t);
+
+static inline int tw_armed(const tw_timer_t *t) { return t->pprev != NULL; }
+
+static inline void tw_unlink(tw_timer_t *t) {
+  *t->pprev = t->next;
+  if (t->next) {
+    t->next->pprev = t->pprev;
+  }
+  t->pprev = NULL;
+}
+
+// links t into the slot of the lowest level whose range covers its expiry,
+// expires must not be in the past
+static inline void tw_place(tw_wheel_t *w, tw_timer_t *t) {
+  uint64_t delta = t->expires - w->now;
+  int level = 0;
+  while (level < TW_LEVELS - 1 && delta >= 1ULL << (TW_BITS * (level + 1))) {
+    ++level;
+  }
+  tw_timer_t **head =
+      &w->slots[level][(t->expires >> (TW_BITS * level)) & TW_MASK];
+  t->next = *head;
+  if (t->next) {
+    t->next->pprev = &t->next;
+  }
+  *head = t;
+  t->pprev = head;
+}
+
+static inline void tw_cancel(tw_wheel_t *w, tw_timer_t *t) {
+  if (tw_armed(t)) {
+    tw_unlink(t);
+    w->armed--;
+  }
+}
+
+// (re-)arms t to expire at tick expires. a tick that has already been
+// advanced to fires with the next one, one too far out is clamped
+static inline void tw_arm(tw_wheel_t *w, tw_timer_t *t, uint64_t expires) {
+  tw_cancel(w, t);
+  if (expires <= w->now) {
+    expires = w->now + 1;
+  } else if (expires - w->now >= TW_RANGE) {
+    expires = w->now + TW_RANGE - 1;
+  }
+  t->expires = expires;
+  tw_place(w, t);
+  w->armed++;
+}
+
+// advances the wheel to tick now and calls cb for every timer due by then
+static inline void tw_advance(tw_wheel_t *w, uint64_t now, tw_expire_cb cb,
+                              void *arg) {
+  while (w->now < now) {
+    if (!w->armed) {
+      w->now = now; // nothing to cascade or fire on the way
+      return;
+    }
+
+    uint64_t tick = ++w->now;
+    for (int level = 1; level < TW_LEVELS; ++level) {
+      if ((tick >> (TW_BITS * (level - 1))) & TW_MASK) {
+        break;
+      }
+      tw_timer_t **head =
+          &w->slots[level][(tick >> (TW_BITS * level)) & TW_MASK];
+      tw_timer_t *t = *head;
+      *head = NULL;
+      while (t) {
+        tw_timer_t *next = t->next;
+        tw_place(w, t);
+        t = next;
+      }
+    }
+
+    tw_timer_t **head = &w->slots[0][tick & TW_MASK];
+    while (*head) {
+      tw_timer_t *t = *head;
+      tw_unlink(t);
+      w->armed--;
+      cb(arg, t);
+    }
+  }
+}
+
+// ticks from now until the next tick that may fire a timer, UINT64_MAX for
+// an empty wheel. a tick that cascades counts as one
+static inline uint64_t tw_next(const tw_wheel_t *w) {
+  if (!w->armed) {
+    return UINT64_MAX;
+  }
+  for (uint64_t i = 1;; ++i) {
+    uint64_t tick = w->now + i;
+    if (!(tick & TW_MASK) || w->slots[0][tick & TW_MASK]) {
+      return i;
+    }
+  }
+}
+
+#endif
@@ -26,63 +26,409 @@ SOFTWARE.
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/signal.h>
 #include <sys/socket.h>
+#include <time.h>
+
+#include "../common/arena.h"
+#include "../common/buf_pool.h"
+#include "../common/cpu.h"
+#include "../common/net.h"
+#include "../common/pipe_pool.h"
+#include "../common/slab.h"
+#include "../common/stats.h"
+#include "../common/timer_wheel.h"
 
 #define DEFAULT_PORT 9919
 #define LISTEN_BACKLOG (1 << 12) /* 4k */
 #define MAX_EVENTS 1024 * 10     /* upto 10240 events */
 #define BUF_SIZE (1 << 13)       /* 8kb */
+#define MAX_THREADS 256
+
+#define OBUF_CHUNK 64            /* overflow buffers per pool chunk */
+#define CONN_NONE SLAB_NONE
+
+/* connection flags, edge-triggered mode and the scheduler (-l) only */
+#define CONN_READABLE (1 << 0) /* input may be left, no EAGAIN seen since */
+#define CONN_WRITABLE (1 << 1) /* no EAGAIN on send since the last EPOLLOUT */
+#define CONN_QUEUED (1 << 2)   /* on the ready list */
+#define CONN_HUP (1 << 3)      /* hung up while queued, closed when run */
+
+#define ACCEPT_REUSEPORT 0 /* one SO_REUSEPORT listener per worker */
+#define ACCEPT_EXCLUSIVE 1 /* one shared listener, EPOLLEXCLUSIVE wakeups */
+
+#define DEFAULT_BUSY_POLL_BUDGET 8 /* the kernel's BUSY_POLL_BUDGET */
+
+/* operations (recvs and sends) a connection may run per turn. fixed without
+ * -l, with it the scheduler adapts the budget between the bounds */
+#define SCHED_NOPS 8
+#define SCHED_NOPS_MIN 2 /* one recv and its echo */
+#define SCHED_NOPS_MAX 64
+
+#define IDLE_TICK_MS 100 /* granularity of the idle timeouts */
+
+#ifndef EPIOCSPARAMS
+/* per epoll instance busy poll parameters, linux 6.9 and newer, older libc
+ * headers don't carry them */
+struct epoll_params {
+  uint32_t busy_poll_usecs;
+  uint16_t busy_poll_budget;
+  uint8_t prefer_busy_poll;
+  uint8_t __pad;
+};
+#define EPOLL_IOC_TYPE 0x8A
+#define EPIOCSPARAMS _IOW(EPOLL_IOC_TYPE, 0x01, struct epoll_params)
+#endif
+
+/* per connection state, only carries an overflow buffer while a send is
+ * partial (slow path) */
+typedef struct {
+  int fd;
+  uint32_t next_free;  /* free list link while the slot is unused */
+  uint32_t next_ready; /* ready list link while CONN_QUEUED is set */
+  uint32_t flags;      /* CONN_* */
+  uint32_t olen;       /* bytes left in obuf */
+  uint32_t ooff;       /* offset of the first unsent byte in obuf */
+  unsigned char *obuf; /* overflow buffer, NULL when nothing is pending */
+  int pipe[2];         /* splice mode: socket -> pipe[1], pipe[0] -> socket */
+  uint32_t plen;       /* splice mode: bytes in the pipe */
+  uint32_t last_active; /* -T: tick of the connection's last event */
+  tw_timer_t idle;      /* -T: armed from accept until the close */
+} conn_t;
+
+#ifdef SERVER_STATS
+typedef struct {
+  stats_hist_t events_per_wait; /* events returned per epoll_wait */
+  stats_hist_t handle_conn_ns;  /* time spent per handle_conn */
+  stats_hist_t drain_ns;        /* time spent per conn_buf_drain */
+  uint64_t messages;       /* recvs that returned data */
+  uint64_t epoll_ctls;     /* epoll_ctl calls on connections */
+  uint64_t short_reads;    /* recvs that returned less than asked for */
+  uint64_t short_writes;   /* sends that moved less than asked for */
+  uint64_t obufs_taken;    /* overflow buffers handed out */
+  uint64_t obufs_returned; /* overflow buffers given back */
+  uint64_t requeued;       /* runs that used up their budget */
+  uint64_t carried;        /* queued connections a round left to the next */
+  sig_atomic_t dump_gen;   /* last stats_dump_gen this worker dumped */
+  int id;
+} server_stats_t;
+#endif
 
 typedef struct {
   struct epoll_event events[MAX_EVENTS]; /* event list */
   struct epoll_event ev;                 /* ctl mod event */
   int epoll_fd;
-  unsigned char sbuf[BUF_SIZE];                      /* hot buffer */
-  unsigned char conn_bufs[MAX_EVENTS][BUF_SIZE]; /* connection specific
-                                                        buffers (slow path) */
+  unsigned char sbuf[BUF_SIZE]; /* hot buffer */
+  /* connection table, addressed by the connection index carried in the
+   * event context, not by fd */
+  slab_t conns;
+  buf_pool_t obufs; /* overflow buffers */
+  /* edge-triggered mode: connections that ran out of budget with work left,
+   * no further edge will report them so they are run again after the next
+   * non-blocking epoll_wait. with -l every ready connection is queued here
+   * and run in turn, see server_run_ready */
+  uint32_t ready_head;
+  uint32_t ready_tail;
+  uint32_t nready;
+  int nops; /* -l: the current per connection budget */
+  pipe_pool_t pipes; /* splice mode: pipes of closed connections */
+  /* the kernel has no per epoll busy poll parameters, they are set on every
+   * accepted socket instead */
+  int busy_poll_sockopt;
+  tw_wheel_t wheel;     /* -T: every connection's idle timer */
+  /* -T: clock when the last epoll_wait returned, events and accepts are
+   * stamped with its tick, the wheel catches up at the top of the loop */
+  uint64_t now_ms;
+  uint32_t tick;
+  uint64_t idle_closed; /* connections closed for being idle */
+#ifdef SERVER_STATS
+  server_stats_t stats;
+#endif
 } server_t;
 
-server_t *server_init(int server_fd);
+/* runtime configuration, filled in by main before any worker starts and
+ * treated as read-only afterwards */
+typedef struct {
+  int port;
+  int threads;           /* number of workers, each owns an epoll instance */
+  int accept_mode;       /* ACCEPT_REUSEPORT or ACCEPT_EXCLUSIVE */
+  int edge_triggered;    /* register connections once with EPOLLET */
+  int splice;            /* echo through a pipe with splice, no copies */
+  int shared_fd;         /* listener shared by all workers (exclusive mode) */
+  int ncpus;             /* number of entries in cpus, 0 means no pinning */
+  int cpus[MAX_THREADS]; /* worker i is pinned to cpus[i % ncpus] */
+  uint32_t busy_poll_usecs;  /* NAPI busy poll time per wait, 0 disables it */
+  uint16_t busy_poll_budget; /* packets per busy poll round */
+  int prefer_busy_poll;      /* keep the device irqs masked while polling */
+  uint64_t latency_ns; /* per iteration latency bound of the scheduler, 0
+                        * runs every event right away with a fixed budget */
+  uint32_t idle_ticks; /* ticks without an event before a connection is
+                        * closed, 0 disables the idle timeouts */
+  int huge_pages;      /* back the server and overflow buffers by huge pages */
+} server_config_t;
+
+static server_config_t cfg = {.port = DEFAULT_PORT,
+                              .threads = 1,
+                              .busy_poll_budget = DEFAULT_BUSY_POLL_BUDGET};
+
+server_t *server_init(int server_fd, uint32_t listen_events);
+static inline int arena_flags(int huge);
 void server_shutdown(server_t *s, int sfd);
-int socket_bind_listen(uint16_t port, uint16_t addr, int backlog);
+
+static void *server_run(void *arg);
+static int socket_set_busy_poll(int fd);
 
 typedef uint64_t event_ctx_t;
 
 static inline int ev_ctx_get_fd(event_ctx_t ctx);
 static inline event_ctx_t ev_ctx_set_fd(event_ctx_t ctx, int fd);
-static inline uint32_t ev_ctx_get_buf_offset(event_ctx_t ctx);
-static inline event_ctx_t ev_ctx_set_buf_offset(event_ctx_t ctx,
-                                                uint32_t offset);
+static inline uint32_t ev_ctx_get_conn(event_ctx_t ctx);
+static inline event_ctx_t ev_ctx_set_conn(event_ctx_t ctx, uint32_t conn);
+
+static uint32_t conn_alloc(server_t *s, int fd);
+static void conn_free(server_t *s, uint32_t idx);
+static inline conn_t *conn_get(server_t *s, uint32_t idx);
+static void server_conn_close(server_t *s, event_ctx_t ctx);
+static void conn_on_idle(void *arg, tw_timer_t *t);
+static inline uint64_t idle_now_ms(void);
 
 int handle_conn(server_t *s, event_ctx_t ctx, int nops);
 
 static int conn_buf_drain(server_t *s, event_ctx_t ctx, int nops);
 
-int main(void) {
+static void conn_event(server_t *s, event_ctx_t ctx, uint32_t events);
+static inline void conn_enqueue(server_t *s, uint32_t idx);
+static void server_run_ready(server_t *s);
+static int conn_run_lt(server_t *s, uint32_t idx, int nops);
+static int conn_run_et(server_t *s, uint32_t idx, int nops);
+static int handle_conn_et(server_t *s, conn_t *c, int nops);
+static int conn_buf_drain_et(server_t *s, conn_t *c, int nops);
+
+static int handle_conn_splice(server_t *s, event_ctx_t ctx, uint32_t events,
+                              int nops);
+static int conn_splice(server_t *s, conn_t *c, int nops);
+
+#ifdef SERVER_STATS
+static void server_stats_dump(server_t *s);
+#endif
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-p port] [-t threads] [-c cpu-list] [-a accept-mode]\n"
+          "          [-e] [-s] [-b usecs] [-B budget] [-P] [-l usecs] "
+          "[-T secs] [-H]\n"
+          "  -p port         port to listen on (default %d)\n"
+          "  -t threads      number of epoll workers (default 1)\n"
+          "  -c cpu-list     cpus to pin workers to, e.g. 2,3,8-11\n"
+          "  -a accept-mode  reuseport (default) or exclusive\n"
+          "  -e              edge-triggered connections, registered once\n"
+          "  -s              echo through a pipe with splice\n"
+          "  -b usecs        busy poll the NIC for up to usecs per wait "
+          "(default off)\n"
+          "  -B budget       packets per busy poll round (default %d)\n"
+          "  -P              prefer busy polling over device interrupts\n"
+          "  -l usecs        run ready connections round robin with an "
+          "adaptive budget,\n"
+          "                  bounding each loop iteration to about usecs\n"
+          "  -T secs         close connections idle for secs (default off)\n"
+          "  -H              back the server and overflow buffers by huge "
+          "pages\n",
+          prog, DEFAULT_PORT, DEFAULT_BUSY_POLL_BUDGET);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  int threads = 0;
+  while ((opt = getopt(argc, argv, "p:t:c:a:esb:B:Pl:T:Hh")) != -1) {
+    switch (opt) {
+    case 'p':
+      cfg.port = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'c':
+      cfg.ncpus = parse_cpu_list(optarg, cfg.cpus, MAX_THREADS);
+      if (cfg.ncpus <= 0) {
+        fprintf(stderr, "invalid cpu list: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'a':
+      if (strcmp(optarg, "reuseport") == 0) {
+        cfg.accept_mode = ACCEPT_REUSEPORT;
+      } else if (strcmp(optarg, "exclusive") == 0) {
+        cfg.accept_mode = ACCEPT_EXCLUSIVE;
+      } else {
+        fprintf(stderr, "unknown accept mode: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'e':
+      cfg.edge_triggered = 1;
+      break;
+    case 's':
+      cfg.splice = 1;
+      break;
+    case 'b':
+      cfg.busy_poll_usecs = strtoul(optarg, NULL, 10);
+      if (cfg.busy_poll_usecs > INT32_MAX) {
+        fprintf(stderr, "invalid busy poll time: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'B':
+      cfg.busy_poll_budget = atoi(optarg);
+      if (cfg.busy_poll_budget == 0) {
+        fprintf(stderr, "invalid busy poll budget: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'P':
+      cfg.prefer_busy_poll = 1;
+      break;
+    case 'l':
+      cfg.latency_ns = strtoull(optarg, NULL, 10) * 1000;
+      if (cfg.latency_ns == 0) {
+        fprintf(stderr, "invalid latency bound: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'T':
+      cfg.idle_ticks = strtoul(optarg, NULL, 10) * 1000 / IDLE_TICK_MS;
+      if (cfg.idle_ticks == 0) {
+        fprintf(stderr, "invalid idle timeout: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'H':
+      cfg.huge_pages = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  /* without an explicit thread count run one worker per listed cpu */
+  cfg.threads = threads ? threads : (cfg.ncpus ? cfg.ncpus : 1);
+  if (cfg.threads < 1 || cfg.threads > MAX_THREADS) {
+    fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+
   printf("pid: %d\n", getpid());
   signal(SIGPIPE, SIG_IGN);
+#ifdef SERVER_STATS
+  stats_install_handler();
+#endif
+
+  if (cfg.accept_mode == ACCEPT_EXCLUSIVE) {
+    cfg.shared_fd =
+        socket_bind_listen(cfg.port, INADDR_ANY, LISTEN_BACKLOG, 0);
+    if (cfg.shared_fd < 0) {
+      perror("socket_bind_listen");
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (cfg.threads == 1) {
+    server_run((void *)0);
+    return EXIT_SUCCESS;
+  }
+
+  pthread_t workers[MAX_THREADS];
+  for (intptr_t i = 0; i < cfg.threads; ++i) {
+    assert(pthread_create(&workers[i], NULL, server_run, (void *)i) == 0);
+  }
+
+  for (int i = 0; i < cfg.threads; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/* every worker owns its epoll instance, hot buffer and overflow buffers.
+ * connections are spread either by the kernel's SO_REUSEPORT hash across
+ * per-worker listeners or by EPOLLEXCLUSIVE waking a single worker for the
+ * shared listener, an accepted connection never leaves its worker */
+static void *server_run(void *arg) {
+  int id = (int)(intptr_t)arg;
+  if (cfg.ncpus) {
+    pin_to_cpu(cfg.cpus[id % cfg.ncpus]);
+  }
+
   struct sockaddr_storage client_sockaddr;
   socklen_t client_socklen;
   client_socklen = sizeof client_sockaddr;
 
-  int server_fd = socket_bind_listen(DEFAULT_PORT, INADDR_ANY, LISTEN_BACKLOG);
-  server_t *server = server_init(server_fd);
+  int server_fd;
+  uint32_t listen_events = EPOLLIN;
+  if (cfg.accept_mode == ACCEPT_EXCLUSIVE) {
+    server_fd = cfg.shared_fd;
+    listen_events |= EPOLLEXCLUSIVE;
+  } else {
+    server_fd = socket_bind_listen(cfg.port, INADDR_ANY, LISTEN_BACKLOG,
+                                   cfg.threads > 1);
+    if (server_fd < 0) {
+      perror("socket_bind_listen");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  server_t *server = server_init(server_fd, listen_events);
+#ifdef SERVER_STATS
+  server->stats.id = id;
+  server->stats.dump_gen = stats_dump_gen;
+#endif
 
   for (;;) {
+#ifdef SERVER_STATS
+    if (server->stats.dump_gen != stats_dump_gen) {
+      server->stats.dump_gen = stats_dump_gen;
+      server_stats_dump(server);
+    }
+#endif
 
-    int n_evs = epoll_wait(server->epoll_fd, server->events, MAX_EVENTS, -1);
+    /* connections left on the ready list only need a peek at new events */
+    int timeout = server->ready_head == CONN_NONE ? -1 : 0;
+    if (cfg.idle_ticks) {
+      /* the wait ends in time for the next tick that has timers to fire */
+      tw_advance(&server->wheel, server->now_ms / IDLE_TICK_MS, conn_on_idle,
+                 server);
+      uint64_t ticks = tw_next(&server->wheel);
+      if (timeout < 0 && ticks != UINT64_MAX) {
+        uint64_t ms = ticks * IDLE_TICK_MS - server->now_ms % IDLE_TICK_MS;
+        timeout = ms < INT32_MAX ? (int)ms : INT32_MAX;
+      }
+    }
+    int n_evs =
+        epoll_wait(server->epoll_fd, server->events, MAX_EVENTS, timeout);
+    if (cfg.idle_ticks) {
+      server->now_ms = idle_now_ms();
+      server->tick = server->now_ms / IDLE_TICK_MS;
+    }
     if (n_evs < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
       perror("epoll_wait");
-      return EXIT_FAILURE;
+      exit(EXIT_FAILURE);
     }
+    STATS_HIST(server->stats.events_per_wait, n_evs);
 
     // loop over events
     for (int i = 0; i < n_evs; ++i) {
@@ -98,68 +444,123 @@ int main(void) {
             break;
           }
 
-          if (client_fd > MAX_EVENTS - 5) {
-            printf("can't index fd: %d\n", client_fd);
+          uint32_t idx = conn_alloc(server, client_fd);
+          if (idx == CONN_NONE) {
+            printf("connection table full, dropping fd: %d\n", client_fd);
             close(client_fd);
             continue;
           }
 
+          if (cfg.splice &&
+              pipe_pool_get(&server->pipes, conn_get(server, idx)->pipe)) {
+            perror("pipe2");
+            /* not conn_free, the slot's pipe fds are still the previous
+             * owner's and already back in the pool or closed */
+            slab_free(&server->conns, idx);
+            close(client_fd);
+            continue;
+          }
+
+          if (server->busy_poll_sockopt && socket_set_busy_poll(client_fd)) {
+            perror("setsockopt(SO_BUSY_POLL)");
+            server->busy_poll_sockopt = 0; /* warn once, not per connection */
+          }
+
           server->ev.events = EPOLLIN | EPOLLRDHUP;
-          server->ev.data.u64 = ev_ctx_set_fd(0, client_fd);
+          if (cfg.edge_triggered) {
+            /* the only epoll_ctl the connection ever sees */
+            server->ev.events |= EPOLLOUT | EPOLLET;
+          }
+          server->ev.data.u64 =
+              ev_ctx_set_conn(ev_ctx_set_fd(0, client_fd), idx);
 
           assert(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client_fd,
                            &server->ev) == 0);
+          STATS_INC(server->stats.epoll_ctls);
+
+          if (cfg.idle_ticks) {
+            conn_t *c = conn_get(server, idx);
+            c->idle.owner = idx;
+            c->last_active = server->tick;
+            tw_arm(&server->wheel, &c->idle, server->tick + cfg.idle_ticks);
+          }
         }
 
+      } else if (cfg.edge_triggered || cfg.latency_ns) {
+        conn_event(server, server->events[i].data.u64,
+                   server->events[i].events);
       } else {
+        if (cfg.idle_ticks) {
+          conn_get(server, ev_ctx_get_conn(server->events[i].data.u64))
+              ->last_active = server->tick;
+        }
         if (server->events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-          int fd = ev_ctx_get_fd(server->events[i].data.u64);
-          assert(epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, fd, &server->ev) ==
-                 0);
-          assert(close(fd) == 0);
+          server_conn_close(server, server->events[i].data.u64);
+        } else if (cfg.splice) {
+          STATS_TIME_START(t0);
+          int ret = handle_conn_splice(server, server->events[i].data.u64,
+                                       server->events[i].events, SCHED_NOPS);
+          STATS_TIME_END(server->stats.handle_conn_ns, t0);
+          if (ret == -1) {
+            server_conn_close(server, server->events[i].data.u64);
+          }
         } else {
           if (server->events[i].events & EPOLLOUT) {
-            int ret = conn_buf_drain(server, server->events[i].data.u64, 8);
+            STATS_TIME_START(t0);
+            int ret = conn_buf_drain(server, server->events[i].data.u64,
+                                     SCHED_NOPS);
+            STATS_TIME_END(server->stats.drain_ns, t0);
             if (ret == -1) {
-              int fd = ev_ctx_get_fd(server->events[i].data.u64);
-              assert(epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, fd,
-                               &server->ev) == 0);
-              assert(close(fd) == 0);
+              server_conn_close(server, server->events[i].data.u64);
             }
 
           } else if (server->events[i].events & EPOLLIN) {
-            int ret = handle_conn(server, server->events[i].data.u64, 8);
+            STATS_TIME_START(t0);
+            int ret = handle_conn(server, server->events[i].data.u64,
+                                  SCHED_NOPS);
+            STATS_TIME_END(server->stats.handle_conn_ns, t0);
             if (ret == -1) {
-              int fd = ev_ctx_get_fd(server->events[i].data.u64);
-              // ev.data.fd = fd;
-              assert(epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, fd,
-                               &server->ev) == 0);
-              assert(close(fd) == 0);
+              server_conn_close(server, server->events[i].data.u64);
             }
           }
         }
       }
     }
+
+    if (server->ready_head != CONN_NONE) {
+      server_run_ready(server);
+    }
   }
 
   server_shutdown(server, server_fd);
 
-  return EXIT_SUCCESS;
+  return NULL;
 }
 
-server_t *server_init(int server_fd) {
-  // create a vm mapping, and mlock the hot portion of the server (back it up by
-  // RAM and keep it there) the connection specific buffers will page fault on a
-  // per needed bases (slow path buffers)
-  server_t *server = mmap(NULL, sizeof *server, PROT_READ | PROT_WRITE,
-                          MAP_ANON | MAP_PRIVATE, -1, 0);
+server_t *server_init(int server_fd, uint32_t listen_events) {
+  // create a vm mapping, and mlock the server (back it up by RAM and keep it
+  // there) connection state and overflow buffers are carved from slabs that
+  // are mapped as connections come and go (slow path buffers). a pinned
+  // worker binds all of them to its numa node
+  server_t *server = arena_map(sizeof *server, arena_flags(1));
   assert(server != MAP_FAILED);
-  if (mlock2(server, offsetof(server_t, conn_bufs), 0) != 0) {
+  slab_init(&server->conns, sizeof(conn_t), offsetof(conn_t, next_free),
+            arena_flags(0));
+  /* with -H a chunk fills a huge page */
+  buf_pool_init(&server->obufs, BUF_SIZE,
+                cfg.huge_pages ? (int)(ARENA_HUGE_PAGE / BUF_SIZE) : OBUF_CHUNK,
+                arena_flags(1));
+  server->ready_head = server->ready_tail = CONN_NONE;
+  server->nops = SCHED_NOPS;
+  server->now_ms = idle_now_ms();
+  server->tick = server->now_ms / IDLE_TICK_MS;
+  server->wheel.now = server->tick;
+  if (mlock2(server, sizeof *server, 0) != 0) {
     fprintf(stdout, "[warning]: mlock failed %s\n", strerror(errno));
     errno = 0;
   };
 
-  printf("listening on port:%d\n", DEFAULT_PORT);
+  printf("listening on port:%d\n", cfg.port);
 
   // set up epoll
   int epoll_fd = epoll_create1(0);
@@ -169,7 +570,27 @@ server_t *server_init(int server_fd) {
   }
   server->epoll_fd = epoll_fd;
 
-  server->ev.events = EPOLLIN;
+  if (cfg.busy_poll_usecs) {
+    /* epoll_wait spins on the NAPI queues of the ready list's sockets for up
+     * to busy_poll_usecs before sleeping */
+    struct epoll_params params = {
+        .busy_poll_usecs = cfg.busy_poll_usecs,
+        .busy_poll_budget = cfg.busy_poll_budget,
+        .prefer_busy_poll = cfg.prefer_busy_poll,
+    };
+    if (ioctl(epoll_fd, EPIOCSPARAMS, &params) != 0) {
+      if (errno != ENOTTY) {
+        perror("ioctl(EPIOCSPARAMS)");
+        exit(EXIT_FAILURE);
+      }
+      fprintf(stdout, "[warning]: no per epoll busy poll parameters, using "
+                      "SO_BUSY_POLL on every connection\n");
+      errno = 0;
+      server->busy_poll_sockopt = 1;
+    }
+  }
+
+  server->ev.events = listen_events;
   server->ev.data.u64 = ev_ctx_set_fd(0, server_fd);
 
   if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &server->ev) < 0) {
@@ -180,65 +601,169 @@ server_t *server_init(int server_fd) {
   return server;
 }
 
-int socket_bind_listen(uint16_t port, uint16_t addr, int backlog) {
-  int server_fd;
-  struct sockaddr_in srv_addr;
-  int ret;
+/* fallback for kernels older than 6.9, epoll_wait itself only spins when
+ * the net.core.busy_poll sysctl is set, raising SO_BUSY_POLL above the
+ * net.core.busy_read sysctl requires CAP_NET_ADMIN */
+static int socket_set_busy_poll(int fd) {
+  int usecs = (int)cfg.busy_poll_usecs;
+  if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof usecs) != 0) {
+    return -1;
+  }
+#ifdef SO_BUSY_POLL_BUDGET
+  int budget = cfg.busy_poll_budget;
+  setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof budget);
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+  setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &cfg.prefer_busy_poll,
+             sizeof cfg.prefer_busy_poll);
+#endif
+  return 0;
+}
 
-  server_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-  if (server_fd < 0) {
-    return server_fd;
+void server_shutdown(server_t *s, int sfd) {
+  // end of event loop
+  close(s->epoll_fd);
+  if (cfg.accept_mode != ACCEPT_EXCLUSIVE) {
+    close(sfd); /* the shared listener outlives the workers */
   }
+  munlockall();
+  slab_destroy(&s->conns);
+  munmap(s, sizeof *s);
+}
+
+static inline conn_t *conn_get(server_t *s, uint32_t idx) {
+  return slab_get(&s->conns, idx);
+}
 
-  int on = 1;
-  ret = setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int));
-  if (ret < 0) {
-    return ret;
+/* flags for a worker's mappings, huge selects whether -H applies to this one */
+static inline int arena_flags(int huge) {
+  return (huge && cfg.huge_pages ? ARENA_HUGE : 0) |
+         (cfg.ncpus ? ARENA_NUMA : 0);
+}
+
+/* hands out an unused connection slot for fd, returns CONN_NONE if the
+ * table is full */
+static uint32_t conn_alloc(server_t *s, int fd) {
+  uint32_t idx = slab_alloc(&s->conns);
+  if (idx == CONN_NONE) {
+    return CONN_NONE;
   }
 
-  memset(&srv_addr, 0, sizeof(srv_addr));
-  srv_addr.sin_family = AF_INET;
-  srv_addr.sin_port = htons(port);
-  srv_addr.sin_addr.s_addr = htons(addr);
+  conn_t *c = conn_get(s, idx);
+  c->fd = fd;
+  c->flags = CONN_WRITABLE;
+  c->olen = 0;
+  c->ooff = 0;
+  c->obuf = NULL;
+  return idx;
+}
 
-  ret = bind(server_fd, (const struct sockaddr *)&srv_addr, sizeof(srv_addr));
-  if (ret < 0) {
-    return ret;
+static void conn_free(server_t *s, uint32_t idx) {
+  conn_t *c = conn_get(s, idx);
+  tw_cancel(&s->wheel, &c->idle);
+  if (c->obuf) {
+    buf_pool_put(&s->obufs, c->obuf);
+    c->obuf = NULL;
+    STATS_INC(s->stats.obufs_returned);
+  }
+  if (cfg.splice) {
+    pipe_pool_put(&s->pipes, c->pipe, c->plen == 0);
+    c->plen = 0;
   }
+  slab_free(&s->conns, idx);
+}
 
-  ret = listen(server_fd, backlog);
-  if (listen(server_fd, backlog)) {
-    perror("listen");
-    exit(1);
+#ifdef SERVER_STATS
+/* formats the whole snapshot first so that dumps of different workers don't
+ * interleave line by line */
+static void server_stats_dump(server_t *s) {
+  server_stats_t *st = &s->stats;
+  char *out = NULL;
+  size_t len = 0;
+  FILE *f = open_memstream(&out, &len);
+  if (!f) {
+    return;
   }
 
-  return server_fd;
+  fprintf(f, "[stats worker %d] messages=%lu epoll_ctls=%lu (%.3f/message) "
+             "short_reads=%lu short_writes=%lu obufs_taken=%lu "
+             "obufs_returned=%lu idle_closed=%lu\n",
+          st->id, st->messages, st->epoll_ctls,
+          st->messages ? (double)st->epoll_ctls / st->messages : 0.0,
+          st->short_reads, st->short_writes, st->obufs_taken,
+          st->obufs_returned, s->idle_closed);
+  if (cfg.latency_ns) {
+    fprintf(f, "  requeued=%lu carried=%lu budget=%d\n", st->requeued,
+            st->carried, s->nops);
+  } else if (cfg.edge_triggered) {
+    fprintf(f, "  requeued=%lu\n", st->requeued);
+  }
+  stats_hist_print(f, "events/wait", &st->events_per_wait);
+  stats_hist_print(f, "handle_conn ns", &st->handle_conn_ns);
+  stats_hist_print(f, "conn_buf_drain ns", &st->drain_ns);
+  fclose(f);
+  fwrite(out, 1, len, stderr);
+  free(out);
 }
+#endif
 
-void server_shutdown(server_t *s, int sfd) {
-  // end of event loop
-  close(s->epoll_fd);
-  close(sfd);
-  munlockall();
-  munmap(s, sizeof *s);
+static void server_conn_close(server_t *s, event_ctx_t ctx) {
+  int fd = ev_ctx_get_fd(ctx);
+  assert(epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, fd, &s->ev) == 0);
+  STATS_INC(s->stats.epoll_ctls);
+  assert(close(fd) == 0);
+  conn_free(s, ev_ctx_get_conn(ctx));
+}
+
+/* events only note the tick they came in at, the timer armed at accept is
+ * pushed out when it fires on a connection that was busy since. one on the
+ * ready list still has work and counts as busy, closing it would pull it
+ * out from under the list */
+static void conn_on_idle(void *arg, tw_timer_t *t) {
+  server_t *s = arg;
+  conn_t *c = conn_get(s, t->owner);
+  uint32_t idle = s->tick - c->last_active;
+  if (c->flags & CONN_QUEUED) {
+    idle = 0;
+  }
+  if (idle < cfg.idle_ticks) {
+    tw_arm(&s->wheel, t, (uint64_t)s->tick + cfg.idle_ticks - idle);
+    return;
+  }
+
+  s->idle_closed++;
+  server_conn_close(s, ev_ctx_set_conn(ev_ctx_set_fd(0, c->fd), t->owner));
+}
+
+static inline uint64_t idle_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 #define would_block(n) (n == -1) & ((errno == EAGAIN) | (errno == EWOULDBLOCK))
 
+/* returns -1 to close the connection, 1 if the budget ran out before recv
+ * would block and 0 otherwise */
 int handle_conn(server_t *s, event_ctx_t ctx, int nops) {
-  // check if the ctx has an offset greater than 0
-  // if it does attempt to drain from the conn_bufs[fd]
   int fd = ev_ctx_get_fd(ctx);
-  uint32_t offset = ev_ctx_get_buf_offset(ctx);
-  assert(!offset); // TODO remove
+  uint32_t offset = 0;
   ssize_t n = 0;
 
   while (nops-- > 0) {
     if ((BUF_SIZE - offset) > 0) {
       n = recv(fd, s->sbuf + offset, BUF_SIZE - offset, 0);
+      STATS_ADD(s->stats.messages, n > 0);
+      STATS_ADD(s->stats.short_reads, n > 0 && n < BUF_SIZE - offset);
       offset += (n > 0) * n;
       if (would_block(n)) {
-        break;
+        return 0;
       } else if ((n == -1) | (n == 0)) {
         return -1;
       }
@@ -247,6 +772,7 @@ int handle_conn(server_t *s, event_ctx_t ctx, int nops) {
     ssize_t wi = 0;
     while ((wi < offset) && (nops-- > 0)) {
       n = send(fd, s->sbuf + wi, offset - wi, 0);
+      STATS_ADD(s->stats.short_writes, n > 0 && n < offset - wi);
       wi += (n > 0) * n;
       if (would_block(n)) {
         break;
@@ -256,29 +782,41 @@ int handle_conn(server_t *s, event_ctx_t ctx, int nops) {
     }
 
     if (wi < offset) {
-      memcpy(s->conn_bufs[fd], s->sbuf + wi, offset - wi);
-      s->ev.data.u64 = ev_ctx_set_buf_offset(ctx, offset - wi);
+      // park the unsent bytes in an overflow buffer until the socket is
+      // writable again
+      conn_t *c = conn_get(s, ev_ctx_get_conn(ctx));
+      c->obuf = buf_pool_get(&s->obufs);
+      if (!c->obuf) {
+        return -1;
+      }
+      STATS_INC(s->stats.obufs_taken);
+      memcpy(c->obuf, s->sbuf + wi, offset - wi);
+      c->ooff = 0;
+      c->olen = offset - wi;
+      s->ev.data.u64 = ctx;
       s->ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLONESHOT;
       assert(epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, fd, &s->ev) == 0);
+      STATS_INC(s->stats.epoll_ctls);
       return 0;
     } else {
       offset = 0;
     }
   }
 
-  return 0;
+  return 1;
 }
 
 static int conn_buf_drain(server_t *s, event_ctx_t ctx, int nops) {
   int fd = ev_ctx_get_fd(ctx);
-  uint32_t offset = ev_ctx_get_buf_offset(ctx);
+  conn_t *c = conn_get(s, ev_ctx_get_conn(ctx));
 
   ssize_t n;
-  ssize_t wi = 0;
-  while ((wi < offset) & (nops-- > 0)) {
-    assert((offset - wi) <= BUF_SIZE);
-    n = send(fd, s->conn_bufs[fd] + wi, offset - wi, 0);
-    wi += (n > 0) * n;
+  while ((c->olen > 0) & (nops-- > 0)) {
+    assert((c->ooff + c->olen) <= BUF_SIZE);
+    n = send(fd, c->obuf + c->ooff, c->olen, 0);
+    STATS_ADD(s->stats.short_writes, n > 0 && n < c->olen);
+    c->ooff += (n > 0) * n;
+    c->olen -= (n > 0) * n;
     if (would_block(n)) {
       break;
     } else if ((n == 0) | (n == -1)) {
@@ -286,20 +824,305 @@ static int conn_buf_drain(server_t *s, event_ctx_t ctx, int nops) {
     }
   }
 
-  if (wi < offset) {
-    memcpy(s->conn_bufs[fd], s->conn_bufs[fd] + wi, offset - wi);
-    s->ev.data.u64 = ev_ctx_set_buf_offset(ctx, offset - wi);
+  s->ev.data.u64 = ctx;
+  STATS_INC(s->stats.epoll_ctls);
+  if (c->olen > 0) {
     s->ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLONESHOT;
     assert(epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, fd, &s->ev) == 0);
   } else {
+    // fully drained, hand the overflow buffer back to the pool
+    buf_pool_put(&s->obufs, c->obuf);
+    c->obuf = NULL;
+    STATS_INC(s->stats.obufs_returned);
     s->ev.events = EPOLLIN | EPOLLRDHUP;
-    s->ev.data.u64 = ev_ctx_set_buf_offset(ctx, 0);
     assert(epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, fd, &s->ev) == 0);
   }
 
   return 0;
 }
 
+/* edge-triggered mode: every connection is registered for EPOLLIN | EPOLLOUT
+ * once at accept and never modified, readiness is remembered in c->flags
+ * until recv or send report EAGAIN. a connection whose budget runs out
+ * before that goes on the ready list instead, as no new edge would wake it
+ * with -l the connection is only queued, in either mode, and runs when the
+ * scheduler gets to it */
+static void conn_event(server_t *s, event_ctx_t ctx, uint32_t events) {
+  uint32_t idx = ev_ctx_get_conn(ctx);
+  conn_t *c = conn_get(s, idx);
+
+  c->last_active = s->tick;
+  c->flags |= (events & EPOLLIN ? CONN_READABLE : 0) |
+              (events & EPOLLOUT ? CONN_WRITABLE : 0);
+  if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+    c->flags |= CONN_HUP;
+  }
+  if (c->flags & CONN_QUEUED) {
+    return; /* runs from the ready list, which must not see it closed */
+  }
+  if (cfg.latency_ns) {
+    conn_enqueue(s, idx);
+    return;
+  }
+
+  STATS_TIME_START(t0);
+  int ret = conn_run_et(s, idx, SCHED_NOPS);
+  STATS_TIME_END(s->stats.handle_conn_ns, t0);
+  if (ret == -1) {
+    server_conn_close(s, ctx);
+  } else if (ret == 1) {
+    conn_enqueue(s, idx);
+    STATS_INC(s->stats.requeued);
+  }
+}
+
+static inline void conn_enqueue(server_t *s, uint32_t idx) {
+  conn_t *c = conn_get(s, idx);
+  c->flags |= CONN_QUEUED;
+  c->next_ready = CONN_NONE;
+  if (s->ready_tail == CONN_NONE) {
+    s->ready_head = idx;
+  } else {
+    conn_get(s, s->ready_tail)->next_ready = idx;
+  }
+  s->ready_tail = idx;
+  s->nready++;
+}
+
+/* runs the connections that were queued when the round started, in order.
+ * one that uses up its budget goes back on the tail, so every queued
+ * connection gets a turn before any gets a second one
+ * with -l the round stops at the latency bound, the connections it did not
+ * get to stay at the head and run first after the next non-blocking
+ * epoll_wait. the budget follows the rounds: one cut short had turns too
+ * long for the bound and halves it, one that drained the list in under half
+ * the bound while connections still ran out grows it, sparing streaming
+ * connections epoll_wait rounds */
+static void server_run_ready(server_t *s) {
+  uint32_t n = s->nready;
+  int nops = cfg.latency_ns ? s->nops : SCHED_NOPS;
+  uint64_t start = cfg.latency_ns ? now_ns() : 0;
+  int exhausted = 0;
+  for (; n > 0; --n) {
+    if (cfg.latency_ns && now_ns() - start >= cfg.latency_ns) {
+      break;
+    }
+
+    uint32_t idx = s->ready_head;
+    conn_t *c = conn_get(s, idx);
+    s->ready_head = c->next_ready;
+    if (s->ready_head == CONN_NONE) {
+      s->ready_tail = CONN_NONE;
+    }
+    s->nready--;
+    c->flags &= ~CONN_QUEUED;
+
+    STATS_TIME_START(t0);
+    int ret = cfg.edge_triggered ? conn_run_et(s, idx, nops)
+                                 : conn_run_lt(s, idx, nops);
+    STATS_TIME_END(s->stats.handle_conn_ns, t0);
+    if (ret == -1) {
+      server_conn_close(s, ev_ctx_set_conn(ev_ctx_set_fd(0, c->fd), idx));
+    } else if (ret == 1) {
+      conn_enqueue(s, idx);
+      exhausted = 1;
+      STATS_INC(s->stats.requeued);
+    }
+  }
+
+  if (!cfg.latency_ns) {
+    return;
+  }
+  if (n > 0) {
+    STATS_ADD(s->stats.carried, n);
+    s->nops = s->nops / 2 > SCHED_NOPS_MIN ? s->nops / 2 : SCHED_NOPS_MIN;
+  } else if (exhausted && now_ns() - start < cfg.latency_ns / 2) {
+    s->nops += s->nops / 2;
+    s->nops = s->nops < SCHED_NOPS_MAX ? s->nops : SCHED_NOPS_MAX;
+  }
+}
+
+/* level-triggered mode with -l: the mode the connection is registered in
+ * says which event queued it, an overflow buffer only ever waits for
+ * EPOLLOUT. a connection that runs out of budget with input left is
+ * reported again by the next epoll_wait as well, queueing it is what keeps
+ * its place in the round robin */
+static int conn_run_lt(server_t *s, uint32_t idx, int nops) {
+  conn_t *c = conn_get(s, idx);
+  if (c->flags & CONN_HUP) {
+    return -1;
+  }
+
+  event_ctx_t ctx = ev_ctx_set_conn(ev_ctx_set_fd(0, c->fd), idx);
+  if (cfg.splice) {
+    return handle_conn_splice(s, ctx, c->plen > 0 ? EPOLLOUT : EPOLLIN, nops);
+  }
+  if (c->obuf) {
+    return conn_buf_drain(s, ctx, nops);
+  }
+  return handle_conn(s, ctx, nops);
+}
+
+/* returns -1 to close the connection, 0 once it waits for an edge and 1 if
+ * the budget ran out first */
+static int conn_run_et(server_t *s, uint32_t idx, int nops) {
+  conn_t *c = conn_get(s, idx);
+  if (c->flags & CONN_HUP) {
+    return -1;
+  }
+
+  if (cfg.splice) {
+    /* a backlog in the pipe waits for the socket, input for the pipe */
+    if (!(c->flags & (c->plen > 0 ? CONN_WRITABLE : CONN_READABLE))) {
+      return 0;
+    }
+    return conn_splice(s, c, nops);
+  }
+
+  if (c->olen > 0) {
+    if (!(c->flags & CONN_WRITABLE)) {
+      return 0; /* input stays unread until the backlog is flushed */
+    }
+    int ret = conn_buf_drain_et(s, c, nops);
+    if (ret != 0 || c->olen > 0) {
+      return ret;
+    }
+  }
+
+  if (c->flags & CONN_READABLE) {
+    return handle_conn_et(s, c, nops);
+  }
+  return 0;
+}
+
+static int handle_conn_et(server_t *s, conn_t *c, int nops) {
+  ssize_t n;
+  while (nops-- > 0) {
+    n = recv(c->fd, s->sbuf, BUF_SIZE, 0);
+    STATS_ADD(s->stats.messages, n > 0);
+    STATS_ADD(s->stats.short_reads, n > 0 && n < BUF_SIZE);
+    if (would_block(n)) {
+      c->flags &= ~CONN_READABLE;
+      return 0;
+    } else if ((n == -1) | (n == 0)) {
+      return -1;
+    }
+
+    uint32_t len = n;
+    ssize_t wi = 0;
+    while ((wi < len) && (nops-- > 0)) {
+      n = send(c->fd, s->sbuf + wi, len - wi, 0);
+      STATS_ADD(s->stats.short_writes, n > 0 && n < len - wi);
+      wi += (n > 0) * n;
+      if (would_block(n)) {
+        c->flags &= ~CONN_WRITABLE;
+        break;
+      } else if ((n == 0) | (n == -1)) {
+        return -1;
+      }
+    }
+
+    if (wi < len) {
+      /* no epoll_ctl, the EPOLLOUT edge is already armed */
+      c->obuf = buf_pool_get(&s->obufs);
+      if (!c->obuf) {
+        return -1;
+      }
+      STATS_INC(s->stats.obufs_taken);
+      memcpy(c->obuf, s->sbuf + wi, len - wi);
+      c->ooff = 0;
+      c->olen = len - wi;
+      return (c->flags & CONN_WRITABLE) ? 1 : 0;
+    }
+  }
+
+  return 1;
+}
+
+/* returns -1 on error, 1 if the budget ran out with bytes left and 0
+ * otherwise, releasing the overflow buffer once it is empty */
+static int conn_buf_drain_et(server_t *s, conn_t *c, int nops) {
+  ssize_t n;
+  while (c->olen > 0) {
+    if (nops-- <= 0) {
+      return 1;
+    }
+    n = send(c->fd, c->obuf + c->ooff, c->olen, 0);
+    STATS_ADD(s->stats.short_writes, n > 0 && n < c->olen);
+    c->ooff += (n > 0) * n;
+    c->olen -= (n > 0) * n;
+    if (would_block(n)) {
+      c->flags &= ~CONN_WRITABLE;
+      return 0;
+    } else if ((n == 0) | (n == -1)) {
+      return -1;
+    }
+  }
+
+  buf_pool_put(&s->obufs, c->obuf);
+  c->obuf = NULL;
+  STATS_INC(s->stats.obufs_returned);
+  return 0;
+}
+
+/* level-triggered splice mode, bytes left in the pipe switch the connection
+ * to EPOLLOUT | EPOLLONESHOT until they are flushed, like the overflow
+ * buffer of the copying path. returns conn_splice's result */
+static int handle_conn_splice(server_t *s, event_ctx_t ctx, uint32_t events,
+                              int nops) {
+  conn_t *c = conn_get(s, ev_ctx_get_conn(ctx));
+  int ret = conn_splice(s, c, nops);
+  if (ret == -1) {
+    return -1;
+  }
+
+  int want_out = c->plen > 0;
+  if (want_out || (events & EPOLLOUT)) {
+    s->ev.data.u64 = ctx;
+    s->ev.events = want_out ? EPOLLOUT | EPOLLRDHUP | EPOLLONESHOT
+                            : EPOLLIN | EPOLLRDHUP;
+    assert(epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &s->ev) == 0);
+    STATS_INC(s->stats.epoll_ctls);
+  }
+  return ret;
+}
+
+/* moves bytes socket -> pipe -> socket without copying them through user
+ * space, the pipe doubles as the overflow buffer. returns -1 on error, 1 if
+ * the budget ran out and 0 once the socket would block, clearing
+ * CONN_READABLE or CONN_WRITABLE to say which way */
+static int conn_splice(server_t *s, conn_t *c, int nops) {
+  ssize_t n;
+  while (nops-- > 0) {
+    if (c->plen > 0) {
+      n = splice(c->pipe[0], NULL, c->fd, NULL, c->plen,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      STATS_ADD(s->stats.short_writes, n > 0 && n < c->plen);
+      c->plen -= (n > 0) * n;
+      if (would_block(n)) {
+        c->flags &= ~CONN_WRITABLE;
+        return 0;
+      } else if ((n == 0) | (n == -1)) {
+        return -1;
+      }
+    } else {
+      n = splice(c->fd, NULL, c->pipe[1], NULL, PIPE_SIZE,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      STATS_ADD(s->stats.messages, n > 0);
+      STATS_ADD(s->stats.short_reads, n > 0 && n < PIPE_SIZE);
+      c->plen += (n > 0) * n;
+      if (would_block(n)) {
+        c->flags &= ~CONN_READABLE;
+        return 0;
+      } else if ((n == 0) | (n == -1)) {
+        return -1;
+      }
+    }
+  }
+
+  return 1;
+}
+
 static inline int ev_ctx_get_fd(event_ctx_t ctx) {
   return ctx & ((1ULL << 32) - 1);
 }
@@ -308,11 +1131,10 @@ static inline event_ctx_t ev_ctx_set_fd(event_ctx_t ctx, int fd) {
   return (ctx & ~((1ULL << 32) - 1)) | (event_ctx_t)fd;
 }
 
-static inline uint32_t ev_ctx_get_buf_offset(event_ctx_t ctx) {
+static inline uint32_t ev_ctx_get_conn(event_ctx_t ctx) {
   return (ctx >> 32) & ((1ULL << 32) - 1);
 }
 
-static inline event_ctx_t ev_ctx_set_buf_offset(event_ctx_t ctx,
-                                                uint32_t offset) {
-  return (ctx & ~(((1ULL << 32) - 1) << 32)) | ((event_ctx_t)offset << 32);
+static inline event_ctx_t ev_ctx_set_conn(event_ctx_t ctx, uint32_t conn) {
+  return (ctx & ~(((1ULL << 32) - 1) << 32)) | ((event_ctx_t)conn << 32);
 }
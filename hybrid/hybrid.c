@@ -0,0 +1,613 @@
+/*
+MIT License
+
+Copyright (c) 2023 Sam, H
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <liburing.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../common/buf_pool.h"
+#include "../common/cpu.h"
+#include "../common/net.h"
+#include "../common/slab.h"
+#include "../common/stats.h"
+
+/* hybrid engine: epoll says which connections are ready, io_uring does the
+ * io. every loop iteration turns the ready connections into one batch of
+ * non-blocking recvs and sends and hands it to the kernel with a single
+ * io_uring_submit_and_wait, the echoes of the recvs that brought data follow
+ * in a second one. that is two syscalls per batch instead of a recv and a
+ * send syscall per message like epoll.c, and without the provided buffers of
+ * io_uring.c */
+
+#define DEFAULT_PORT 9919
+#define LISTEN_BACKLOG (1 << 12) /* 4k */
+#define BUF_SIZE (1 << 13)       /* 8kb, the recv size of epoll.c */
+#define BATCH_MAX 256            /* events per wait, recvs per submission */
+#define SQ_DEPTH BATCH_MAX /* one op per event, or one echo per recv */
+#define MAX_THREADS 256
+
+#define OBUF_CHUNK 64 /* overflow buffers per pool chunk */
+#define CONN_NONE SLAB_NONE
+
+#define OP_RECV 0  /* recv into an sbuf slot */
+#define OP_ECHO 1  /* send out of the sbuf slot the data was received into */
+#define OP_DRAIN 2 /* send out of the overflow buffer on EPOLLOUT */
+
+/* per connection state, only carries an overflow buffer while an echo is
+ * partial (slow path) */
+typedef struct {
+  int fd;              /* -1 once closed */
+  uint32_t next_free;  /* free list link while the slot is unused */
+  uint32_t olen;       /* bytes left in obuf */
+  uint32_t ooff;       /* offset of the first unsent byte in obuf */
+  unsigned char *obuf; /* overflow buffer, NULL when nothing is pending */
+} conn_t;
+
+#ifdef SERVER_STATS
+typedef struct {
+  stats_hist_t events_per_wait; /* events returned per epoll_wait */
+  stats_hist_t sqes_per_submit; /* ops per io_uring_submit_and_wait */
+  uint64_t messages;       /* recvs that returned data */
+  uint64_t stale;          /* recvs that found nothing despite EPOLLIN */
+  uint64_t epoll_ctls;     /* epoll_ctl calls on connections */
+  uint64_t short_reads;    /* recvs that returned less than asked for */
+  uint64_t short_writes;   /* sends that moved less than asked for */
+  uint64_t obufs_taken;    /* overflow buffers handed out */
+  uint64_t obufs_returned; /* overflow buffers given back */
+  sig_atomic_t dump_gen;   /* last stats_dump_gen this worker dumped */
+  int id;
+} server_stats_t;
+#endif
+
+typedef struct {
+  struct io_uring ring;
+  struct epoll_event events[BATCH_MAX]; /* event list */
+  struct epoll_event ev;                /* ctl mod event */
+  int epoll_fd;
+  /* epoll.c's hot buffer, one per connection of a batch. the batch's echoes
+   * go out of the slot their data was received into, and they complete
+   * before the next batch reuses it */
+  unsigned char sbuf[BATCH_MAX][BUF_SIZE];
+  uint32_t slot_len[BATCH_MAX]; /* bytes received into each slot */
+  uint32_t nslots;              /* slots in use by this batch */
+  /* connection table, addressed by the connection index carried in the
+   * event and op contexts, not by fd */
+  slab_t conns;
+  buf_pool_t obufs; /* overflow buffers */
+#ifdef SERVER_STATS
+  server_stats_t stats;
+#endif
+} server_t;
+
+/* runtime configuration, filled in by main before any worker starts and
+ * treated as read-only afterwards */
+typedef struct {
+  int port;
+  int threads;           /* number of workers, each owns epoll and a ring */
+  int ncpus;             /* number of entries in cpus, 0 means no pinning */
+  int cpus[MAX_THREADS]; /* worker i is pinned to cpus[i % ncpus] */
+} server_config_t;
+
+static server_config_t cfg = {.port = DEFAULT_PORT, .threads = 1};
+
+server_t *server_init(int server_fd);
+void server_shutdown(server_t *s, int sfd);
+
+static void *server_run(void *arg);
+
+typedef uint64_t event_ctx_t;
+
+static inline int ev_ctx_get_fd(event_ctx_t ctx);
+static inline event_ctx_t ev_ctx_set_fd(event_ctx_t ctx, int fd);
+static inline uint32_t ev_ctx_get_conn(event_ctx_t ctx);
+static inline event_ctx_t ev_ctx_set_conn(event_ctx_t ctx, uint32_t conn);
+
+static inline uint64_t op_ctx(uint32_t conn, int op, uint32_t slot);
+static inline uint32_t op_ctx_get_conn(uint64_t ctx);
+static inline int op_ctx_get_op(uint64_t ctx);
+static inline uint32_t op_ctx_get_slot(uint64_t ctx);
+
+static uint32_t conn_alloc(server_t *s, int fd);
+static void conn_free(server_t *s, uint32_t idx);
+static inline conn_t *conn_get(server_t *s, uint32_t idx);
+static void server_conn_close(server_t *s, uint32_t idx);
+
+static void server_accept(server_t *s, int server_fd);
+static void conn_event(server_t *s, event_ctx_t ctx, uint32_t events);
+static void server_reap(server_t *s);
+static void on_send(server_t *s, struct io_uring_cqe *cqe);
+static void on_recv(server_t *s, struct io_uring_cqe *cqe);
+static void conn_want_out(server_t *s, uint32_t idx, int out);
+
+static struct io_uring_sqe *must_get_sqe(server_t *s);
+
+#ifdef SERVER_STATS
+static void server_stats_dump(server_t *s);
+#endif
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-p port] [-t threads] [-c cpu-list]\n"
+          "  -p port         port to listen on (default %d)\n"
+          "  -t threads      number of workers (default 1)\n"
+          "  -c cpu-list     cpus to pin workers to, e.g. 2,3,8-11\n",
+          prog, DEFAULT_PORT);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  int threads = 0;
+  while ((opt = getopt(argc, argv, "p:t:c:h")) != -1) {
+    switch (opt) {
+    case 'p':
+      cfg.port = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'c':
+      cfg.ncpus = parse_cpu_list(optarg, cfg.cpus, MAX_THREADS);
+      if (cfg.ncpus <= 0) {
+        fprintf(stderr, "invalid cpu list: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  /* without an explicit thread count run one worker per listed cpu */
+  cfg.threads = threads ? threads : (cfg.ncpus ? cfg.ncpus : 1);
+  if (cfg.threads < 1 || cfg.threads > MAX_THREADS) {
+    fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+
+  printf("pid: %d\n", getpid());
+  signal(SIGPIPE, SIG_IGN);
+#ifdef SERVER_STATS
+  stats_install_handler();
+#endif
+
+  if (cfg.threads == 1) {
+    server_run((void *)0);
+    return EXIT_SUCCESS;
+  }
+
+  pthread_t workers[MAX_THREADS];
+  for (intptr_t i = 0; i < cfg.threads; ++i) {
+    assert(pthread_create(&workers[i], NULL, server_run, (void *)i) == 0);
+  }
+
+  for (int i = 0; i < cfg.threads; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/* every worker owns a SO_REUSEPORT listener, an epoll instance, a ring and
+ * its buffers, an accepted connection never leaves its worker.
+ *
+ * an iteration waits for events, queues a recv per readable connection and
+ * a drain per writable one, submits them all at once and handles the
+ * completions. the sockets are ready and every op carries MSG_DONTWAIT, so
+ * they complete inline during the submit and the wait for all of them does
+ * not block. the echoes of the recvs are submitted the same way before the
+ * next epoll_wait */
+static void *server_run(void *arg) {
+  int id = (int)(intptr_t)arg;
+  if (cfg.ncpus) {
+    pin_to_cpu(cfg.cpus[id % cfg.ncpus]);
+  }
+
+  int server_fd = socket_bind_listen(cfg.port, INADDR_ANY, LISTEN_BACKLOG,
+                                     cfg.threads > 1);
+  if (server_fd < 0) {
+    perror("socket_bind_listen");
+    exit(EXIT_FAILURE);
+  }
+
+  server_t *server = server_init(server_fd);
+#ifdef SERVER_STATS
+  server->stats.id = id;
+  server->stats.dump_gen = stats_dump_gen;
+#endif
+
+  for (;;) {
+#ifdef SERVER_STATS
+    if (server->stats.dump_gen != stats_dump_gen) {
+      server->stats.dump_gen = stats_dump_gen;
+      server_stats_dump(server);
+    }
+#endif
+
+    int n_evs = epoll_wait(server->epoll_fd, server->events, BATCH_MAX, -1);
+    if (n_evs < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      exit(EXIT_FAILURE);
+    }
+    STATS_HIST(server->stats.events_per_wait, n_evs);
+
+    server->nslots = 0;
+    for (int i = 0; i < n_evs; ++i) {
+      if (ev_ctx_get_fd(server->events[i].data.u64) == server_fd) {
+        server_accept(server, server_fd);
+      } else {
+        conn_event(server, server->events[i].data.u64,
+                   server->events[i].events);
+      }
+    }
+
+    /* the recvs and drains, then the echoes their completions queued */
+    unsigned nsqes;
+    while ((nsqes = io_uring_sq_ready(&server->ring)) != 0) {
+      int ret = io_uring_submit_and_wait(&server->ring, nsqes);
+      if (ret < 0 && ret != -EINTR) {
+        fprintf(stderr, "io_uring_submit_and_wait: %s\n", strerror(-ret));
+        exit(EXIT_FAILURE);
+      }
+      STATS_HIST(server->stats.sqes_per_submit, nsqes);
+      server_reap(server);
+    }
+  }
+
+  server_shutdown(server, server_fd);
+
+  return NULL;
+}
+
+server_t *server_init(int server_fd) {
+  // create a vm mapping, and mlock the server (back it up by RAM and keep it
+  // there) connection state and overflow buffers are carved from slabs that
+  // are mapped as connections come and go (slow path buffers)
+  server_t *server = mmap(NULL, sizeof *server, PROT_READ | PROT_WRITE,
+                          MAP_ANON | MAP_PRIVATE, -1, 0);
+  assert(server != MAP_FAILED);
+  slab_init(&server->conns, sizeof(conn_t), offsetof(conn_t, next_free), 0);
+  buf_pool_init(&server->obufs, BUF_SIZE, OBUF_CHUNK, 0);
+  if (mlock2(server, sizeof *server, 0) != 0) {
+    fprintf(stdout, "[warning]: mlock failed %s\n", strerror(errno));
+    errno = 0;
+  };
+
+  printf("listening on port:%d\n", cfg.port);
+
+  /* the ring is only ever entered by this worker, and only to submit a batch
+   * and collect its completions, the task work can wait for that */
+  struct io_uring_params params;
+  memset(&params, 0, sizeof params);
+  params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_DEFER_TASKRUN |
+                 IORING_SETUP_SINGLE_ISSUER;
+  int ret = io_uring_queue_init_params(SQ_DEPTH, &server->ring, &params);
+  if (ret < 0) {
+    fprintf(stderr, "io_uring_queue_init_params: %s\n", strerror(-ret));
+    exit(EXIT_FAILURE);
+  }
+  assert(io_uring_register_ring_fd(&server->ring) == 1);
+
+  // set up epoll
+  int epoll_fd = epoll_create1(0);
+  if (epoll_fd < 0) {
+    perror("epoll_create1");
+    exit(EXIT_FAILURE);
+  }
+  server->epoll_fd = epoll_fd;
+
+  server->ev.events = EPOLLIN;
+  server->ev.data.u64 = ev_ctx_set_fd(0, server_fd);
+
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &server->ev) < 0) {
+    perror("epoll_ctl");
+    exit(EXIT_FAILURE);
+  };
+
+  return server;
+}
+
+void server_shutdown(server_t *s, int sfd) {
+  // end of event loop
+  io_uring_queue_exit(&s->ring);
+  close(s->epoll_fd);
+  close(sfd);
+  munlockall();
+  slab_destroy(&s->conns);
+  munmap(s, sizeof *s);
+}
+
+static void server_accept(server_t *s, int server_fd) {
+  for (;;) {
+    int client_fd = accept4(server_fd, NULL, NULL, O_NONBLOCK);
+    if (client_fd < 0) {
+      if (errno != EAGAIN) {
+        perror("accept");
+      }
+      return;
+    }
+
+    uint32_t idx = conn_alloc(s, client_fd);
+    if (idx == CONN_NONE) {
+      printf("connection table full, dropping fd: %d\n", client_fd);
+      close(client_fd);
+      continue;
+    }
+
+    s->ev.events = EPOLLIN | EPOLLRDHUP;
+    s->ev.data.u64 = ev_ctx_set_conn(ev_ctx_set_fd(0, client_fd), idx);
+    assert(epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, client_fd, &s->ev) == 0);
+    STATS_INC(s->stats.epoll_ctls);
+  }
+}
+
+/* turns an event into the op for this iteration's batch, a connection is
+ * reported at most once per epoll_wait so it has at most one recv or drain
+ * in a batch. nothing of the last batch is still in flight */
+static void conn_event(server_t *s, event_ctx_t ctx, uint32_t events) {
+  uint32_t idx = ev_ctx_get_conn(ctx);
+  conn_t *c = conn_get(s, idx);
+  struct io_uring_sqe *sqe;
+
+  if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+    server_conn_close(s, idx);
+  } else if (events & EPOLLOUT) {
+    sqe = must_get_sqe(s);
+    io_uring_prep_send(sqe, c->fd, c->obuf + c->ooff, c->olen, MSG_DONTWAIT);
+    io_uring_sqe_set_data64(sqe, op_ctx(idx, OP_DRAIN, 0));
+  } else if (events & EPOLLIN) {
+    uint32_t slot = s->nslots++;
+    sqe = must_get_sqe(s);
+    io_uring_prep_recv(sqe, c->fd, s->sbuf[slot], BUF_SIZE, MSG_DONTWAIT);
+    io_uring_sqe_set_data64(sqe, op_ctx(idx, OP_RECV, slot));
+  }
+}
+
+/* a batch touches every connection at most once, so the completions can be
+ * handled in any order */
+static void server_reap(server_t *s) {
+  struct io_uring_cqe *cqe;
+  unsigned head;
+  unsigned n = 0;
+
+  io_uring_for_each_cqe(&s->ring, head, cqe) {
+    ++n;
+    if (op_ctx_get_op(cqe->user_data) == OP_RECV) {
+      on_recv(s, cqe);
+    } else {
+      on_send(s, cqe);
+    }
+  }
+
+  io_uring_cq_advance(&s->ring, n);
+}
+
+static void on_send(server_t *s, struct io_uring_cqe *cqe) {
+  uint64_t ctx = cqe->user_data;
+  uint32_t idx = op_ctx_get_conn(ctx);
+  conn_t *c = conn_get(s, idx);
+  int n = cqe->res == -EAGAIN ? 0 : cqe->res;
+
+  if (n < 0) {
+    server_conn_close(s, idx);
+    return;
+  }
+
+  if (op_ctx_get_op(ctx) == OP_DRAIN) {
+    STATS_ADD(s->stats.short_writes, (uint32_t)n < c->olen);
+    c->ooff += n;
+    c->olen -= n;
+    if (c->olen == 0) {
+      // fully drained, hand the overflow buffer back to the pool
+      buf_pool_put(&s->obufs, c->obuf);
+      c->obuf = NULL;
+      STATS_INC(s->stats.obufs_returned);
+    }
+    conn_want_out(s, idx, c->olen > 0);
+    return;
+  }
+
+  uint32_t slot = op_ctx_get_slot(ctx);
+  uint32_t len = s->slot_len[slot];
+  if ((uint32_t)n < len) {
+    // park the unsent bytes in an overflow buffer until the socket is
+    // writable again
+    STATS_INC(s->stats.short_writes);
+    c->obuf = buf_pool_get(&s->obufs);
+    if (!c->obuf) {
+      server_conn_close(s, idx);
+      return;
+    }
+    STATS_INC(s->stats.obufs_taken);
+    memcpy(c->obuf, s->sbuf[slot] + n, len - n);
+    c->ooff = 0;
+    c->olen = len - n;
+    conn_want_out(s, idx, 1);
+  }
+}
+
+static void on_recv(server_t *s, struct io_uring_cqe *cqe) {
+  uint64_t ctx = cqe->user_data;
+  uint32_t idx = op_ctx_get_conn(ctx);
+  conn_t *c = conn_get(s, idx);
+
+  if (cqe->res == -EAGAIN) {
+    STATS_INC(s->stats.stale);
+    return;
+  } else if (cqe->res <= 0) {
+    server_conn_close(s, idx);
+    return;
+  }
+
+  /* queued for the submission right after this reap */
+  uint32_t slot = op_ctx_get_slot(ctx);
+  STATS_INC(s->stats.messages);
+  STATS_ADD(s->stats.short_reads, cqe->res < BUF_SIZE);
+  s->slot_len[slot] = cqe->res;
+  struct io_uring_sqe *sqe = must_get_sqe(s);
+  io_uring_prep_send(sqe, c->fd, s->sbuf[slot], cqe->res, MSG_DONTWAIT);
+  io_uring_sqe_set_data64(sqe, op_ctx(idx, OP_ECHO, slot));
+}
+
+/* a connection with bytes in its overflow buffer only waits for EPOLLOUT, its
+ * input stays unread until the backlog is flushed */
+static void conn_want_out(server_t *s, uint32_t idx, int out) {
+  conn_t *c = conn_get(s, idx);
+  s->ev.data.u64 = ev_ctx_set_conn(ev_ctx_set_fd(0, c->fd), idx);
+  s->ev.events =
+      out ? EPOLLOUT | EPOLLRDHUP | EPOLLONESHOT : EPOLLIN | EPOLLRDHUP;
+  assert(epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &s->ev) == 0);
+  STATS_INC(s->stats.epoll_ctls);
+}
+
+/* a batch never holds more than SQ_DEPTH ops, running out of sqes is a bug */
+static struct io_uring_sqe *must_get_sqe(server_t *s) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
+  assert(sqe != NULL);
+  return sqe;
+}
+
+static inline conn_t *conn_get(server_t *s, uint32_t idx) {
+  return slab_get(&s->conns, idx);
+}
+
+/* hands out an unused connection slot for fd, returns CONN_NONE if the
+ * table is full */
+static uint32_t conn_alloc(server_t *s, int fd) {
+  uint32_t idx = slab_alloc(&s->conns);
+  if (idx == CONN_NONE) {
+    return CONN_NONE;
+  }
+
+  conn_t *c = conn_get(s, idx);
+  c->fd = fd;
+  c->olen = 0;
+  c->ooff = 0;
+  c->obuf = NULL;
+  return idx;
+}
+
+static void conn_free(server_t *s, uint32_t idx) {
+  conn_t *c = conn_get(s, idx);
+  if (c->obuf) {
+    buf_pool_put(&s->obufs, c->obuf);
+    c->obuf = NULL;
+    STATS_INC(s->stats.obufs_returned);
+  }
+  c->fd = -1;
+  slab_free(&s->conns, idx);
+}
+
+#ifdef SERVER_STATS
+/* formats the whole snapshot first so that dumps of different workers don't
+ * interleave line by line */
+static void server_stats_dump(server_t *s) {
+  server_stats_t *st = &s->stats;
+  char *out = NULL;
+  size_t len = 0;
+  FILE *f = open_memstream(&out, &len);
+  if (!f) {
+    return;
+  }
+
+  fprintf(f, "[stats worker %d] messages=%lu stale=%lu epoll_ctls=%lu "
+             "(%.3f/message) short_reads=%lu short_writes=%lu "
+             "obufs_taken=%lu obufs_returned=%lu\n",
+          st->id, st->messages, st->stale, st->epoll_ctls,
+          st->messages ? (double)st->epoll_ctls / st->messages : 0.0,
+          st->short_reads, st->short_writes, st->obufs_taken,
+          st->obufs_returned);
+  stats_hist_print(f, "events/wait", &st->events_per_wait);
+  stats_hist_print(f, "sqes/submit", &st->sqes_per_submit);
+  fclose(f);
+  fwrite(out, 1, len, stderr);
+  free(out);
+}
+#endif
+
+static void server_conn_close(server_t *s, uint32_t idx) {
+  int fd = conn_get(s, idx)->fd;
+  assert(epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, fd, &s->ev) == 0);
+  STATS_INC(s->stats.epoll_ctls);
+  assert(close(fd) == 0);
+  conn_free(s, idx);
+}
+
+
+static inline int ev_ctx_get_fd(event_ctx_t ctx) {
+  return ctx & ((1ULL << 32) - 1);
+}
+
+static inline event_ctx_t ev_ctx_set_fd(event_ctx_t ctx, int fd) {
+  return (ctx & ~((1ULL << 32) - 1)) | (event_ctx_t)fd;
+}
+
+static inline uint32_t ev_ctx_get_conn(event_ctx_t ctx) {
+  return (ctx >> 32) & ((1ULL << 32) - 1);
+}
+
+static inline event_ctx_t ev_ctx_set_conn(event_ctx_t ctx, uint32_t conn) {
+  return (ctx & ~(((1ULL << 32) - 1) << 32)) | ((event_ctx_t)conn << 32);
+}
+
+/* op context layout: connection index in the low 32 bits, then 8 bits of
+ * op and 16 bits of slot */
+#define OP_SHIFT 32
+#define SLOT_SHIFT 48
+
+static inline uint64_t op_ctx(uint32_t conn, int op, uint32_t slot) {
+  return (uint64_t)conn | ((uint64_t)op << OP_SHIFT) |
+         ((uint64_t)slot << SLOT_SHIFT);
+}
+
+static inline uint32_t op_ctx_get_conn(uint64_t ctx) {
+  return ctx & ((1ULL << 32) - 1);
+}
+
+static inline int op_ctx_get_op(uint64_t ctx) {
+  return (ctx >> OP_SHIFT) & 0xff;
+}
+
+static inline uint32_t op_ctx_get_slot(uint64_t ctx) {
+  return (ctx >> SLOT_SHIFT) & 0xffff;
+}
@@ -22,79 +22,399 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 
 */
+#define _GNU_SOURCE
 #include <assert.h>
+#include <getopt.h>
 #include <liburing.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
-#define FD_COUNT 1024
-#define LISTEN_BACKLOG 1024
+#include "../common/arena.h"
+#include "../common/cpu.h"
+#include "../common/pipe_pool.h"
+#include "../common/stats.h"
+#include "../common/timer_wheel.h"
+
+// NAPI busy polling needs liburing 2.6, the kernel side needs 6.9
+#if defined(IO_URING_VERSION_MAJOR) &&                                         \
+    (IO_URING_VERSION_MAJOR > 2 ||                                             \
+     (IO_URING_VERSION_MAJOR == 2 && IO_URING_VERSION_MINOR >= 6))
+#define HAVE_NAPI 1
+#endif
+
+// recv bundles need 6.10 kernel headers
+#ifdef IORING_RECVSEND_BUNDLE
+#define HAVE_BUNDLES 1
+#endif
+
+// incremental buffer consumption needs 6.12 kernel headers
+#ifdef IORING_CQE_F_BUF_MORE
+#define HAVE_PBUF_INC 1
+#endif
+
+// multishot timeouts need 6.4 kernel headers
+#ifdef IORING_TIMEOUT_MULTISHOT
+#define HAVE_TIMEOUT_MULTISHOT 1
+#endif
+
+#define DEFAULT_PORT 9919
+#define MAX_THREADS 256
+
+#define DEFAULT_MAX_CONNS (1 << 16)
+#define MAX_CONNS (1 << 21) // direct descriptors must fit the fd bits of ctx
+#define LISTEN_BACKLOG (1 << 12)
+
+// the rings are sized independently of the connection count, a full sq is
+// submitted early by must_get_sqe and an overflowing cq is flushed by the
+// kernel once the loop made room again
+#define DEFAULT_SQ_DEPTH 1024
+#define DEFAULT_CQ_DEPTH (DEFAULT_SQ_DEPTH * 4)
+
+#define DEFAULT_SQ_IDLE_MS 1000 // sqpoll thread sleeps after this much idling
+
+// provided buffers come in size classes, one buffer group each. connections
+// move between groups based on how much their recvs actually carry
+#define BG_COUNT 3
+#define BG_INITIAL 1      // group a new connection starts out in
+#define BG_SHRINK_AFTER 8 // consecutive small recvs before moving down a group
+#define BG_MAX_GROWTH 4   // a starved group may grow up to this many times its
+                          // initial size, by doubling
+#define BG_INC (BG_COUNT - 1) // with -i every connection shares the largest
+                              // buffers
 
-#define SQ_DEPTH FD_COUNT
-#define BG_ENTRIES FD_COUNT
-#define BUF_BASE_OFFSET (sizeof(struct io_uring_buf) * BG_ENTRIES)
-
-#define BUFF_CAP 1024 * 8
 #define EV_ACCEPT 0
 #define EV_RECV 1
 #define EV_SEND 2
 #define EV_CLOSE 3
+#define EV_CANCEL 4
+#define EV_SEND_ZC 5 // zero-copy send, completes once more with F_NOTIF
+#define EV_SPLICE_IN 6
+#define EV_SPLICE_OUT 7
+#define EV_TIMEOUT 8 // the idle timer wheel's tick
+#define EV_COUNT 9
+
+#define SPLICE_POLL 1 // buf idx of the poll in front of a splice in
+
+// -A: buf idx of the accepts the acceptor ring passes on to the workers
+#define ACCEPT_PASSED 1      // the worker's cqe for a connection it received
+#define ACCEPT_PASS_FAILED 2 // the acceptor's cqe for a pass that failed
+#define ACCEPTOR_SQ_DEPTH 256
+#define ACCEPTOR_SLOTS 4096 // a slot is only held until its pass ran
+
+#define BUF_NONE UINT32_MAX   // end of a connection's send queue
+#define CONN_NONE UINT32_MAX // end of a buffer group's wait list
+
+// a connection stops receiving once this many bytes wait to be echoed and
+// resumes when its queue drained below half of it
+#define SENDQ_HIGH_WATERMARK (1024 * 64)
+
+#define BUNDLE_MAX_IOVS 16 // queued buffers gathered into one sendmsg
+
+#define IDLE_TICK_MS 100 // granularity of the idle timeouts
 
 #define LIKELY(x) __builtin_expect(!!(x), 1)
 #define UNLIKELY(x) __builtin_expect(!!(x), 0)
 
-static_assert(!(BG_ENTRIES & (BG_ENTRIES - 1)),
-              "BG_ENTRIES must be a power of two");
+typedef struct {
+  uint32_t buf_size; // bytes per buffer
+  uint32_t entries;  // buffers in the group, must be a power of two
+} buf_class_t;
 
-static_assert(!(SQ_DEPTH & (SQ_DEPTH - 1)), "SQ_DEPTH must be a power of two");
+static const buf_class_t buf_classes[BG_COUNT] = {
+    {512, 1024}, {1024 * 4, 1024}, {1024 * 64, 128}};
 
 typedef struct server_t server_t;
 typedef void (*io_event_cb)(server_t *s, uint64_t ctx,
                             struct io_uring_cqe *cqe);
 
+// received buffers waiting to be echoed are queued per connection and sent
+// one at a time, so echoes keep their order even when several recvs
+// complete while a send is still in flight
+// queued buffers are referred to by their index into buf_meta, which covers
+// the buffers of all groups back to back, followed by the slices of -i
+typedef struct {
+  uint32_t queued;     // bytes waiting to be echoed
+  uint32_t sendq_head; // first queued buffer, BUF_NONE when empty
+  uint32_t sendq_tail; // last queued buffer
+  uint8_t sending;     // the buffer at sendq_head is being sent
+  uint8_t recv_armed;  // a one-shot or multishot recv is outstanding
+  uint8_t paused;      // receiving stopped until the queue drains
+  uint8_t closing;     // close once nothing is outstanding anymore
+  uint8_t bgid;        // group the next recv selects its buffer from
+  uint8_t recv_bgid;   // group of the outstanding recv
+  uint8_t small_recvs; // consecutive recvs that fit the next smaller group
+  uint8_t parked;      // on a buffer group's wait list
+  uint32_t wait_prev;  // neighbours on the wait list
+  uint32_t wait_next;
+  uint32_t last_active; // -T: tick of the last recv or send that moved data
+  tw_timer_t idle;      // -T: armed from accept until the close is issued
+} conn_t;
+
+// a buffer sent zero-copy stays pinned by the network stack after the send
+// completed, it is only recycled once every notification for it came in
+// with -i the kernel packs the recvs of many connections into one buffer.
+// each recv is queued as a slice, an entry of its own that points into the
+// buffer, and the buffer is recycled once the kernel and every slice let go
+typedef struct {
+  uint32_t len;      // bytes received into the buffer
+  uint32_t off;      // bytes of it already sent
+  uint32_t next;     // next buffer in the owning connection's send queue
+  uint32_t base;     // slice: where its bytes start in the buffer
+  uint32_t fill;     // -i: bytes of the buffer the kernel has filled
+  uint32_t refs;     // -i: slices of the buffer, plus one for the kernel
+  uint16_t bid;      // buffer id within its group
+  uint8_t bgid;      // group the buffer belongs to
+  uint8_t zc_notifs; // zero-copy notifications still to come
+  uint8_t released;  // off the send queue, recycle once zc_notifs is 0
+} buf_meta_t;
+
+// connections whose recv found the group empty wait on the group's wait
+// list and get their recv re-armed as buffers are recycled into the group
+// recycled buffers collect in pending and are only written to the ring once
+// per batch of completions, see server_flush_bufs
+typedef struct {
+  struct io_uring_buf_ring *br; // ring mapped buffer
+  unsigned char *bufs;          // first buffer, right behind the ring
+  uint32_t buf_size;            // bytes per buffer
+  uint32_t entries;             // buffers handed to the kernel so far
+  uint32_t max_entries;         // ring size, the group can grow up to it
+  uint32_t meta_base;           // index of the group's first buffer in buf_meta
+  uint32_t wait_head;           // parked connections, CONN_NONE when empty
+  uint32_t wait_tail;
+  uint16_t *pending;            // buffer ids waiting to go back to the ring
+  uint32_t npending;
+  uint16_t *bid_pos;            // ring position each buffer was last added at
+} buf_group_t;
+
+// bundle mode gathers the send queue into one sendmsg. the kernel copies the
+// header and the iovecs when it takes the sqe, so each sqe slot owns one
+typedef struct {
+  struct msghdr msg;
+  struct iovec iov[BUNDLE_MAX_IOVS];
+} send_msg_t;
+
+// -A: what the acceptor knows about a worker. the ring fd is written once
+// before the rings_ready barrier, closed only ever by the worker itself
+typedef struct {
+  int ring_fd;     // the worker's ring, target of the msg ring fd passes
+  uint32_t closed; // connections the worker closed so far
+} __attribute__((aligned(64))) worker_link_t;
+
+typedef struct {
+  uint64_t enobufs; // recvs that found their buffer group empty
+  uint64_t grown;   // times a buffer group was grown
+  uint64_t parked;  // connections put on a wait list
+  uint64_t woken;   // parked connections re-armed by a recycled buffer
+} bp_stats_t;
+
+#ifdef SERVER_STATS
+typedef struct {
+  stats_hist_t cqes_per_wait;        // cqes reaped per io_uring_submit_and_wait
+  stats_hist_t handler_ns[EV_COUNT]; // time spent per completion, by event
+  uint64_t recycled;      // buffers handed back to their group
+  uint64_t short_reads;   // recvs that did not fill their buffer
+  uint64_t short_writes;  // sends that moved fewer bytes than asked for
+  uint64_t early_submits; // full sq submitted from must_get_sqe
+  uint64_t sq_wakeups;    // submits that found the sqpoll thread asleep
+  uint64_t bundled_recvs; // recvs that filled more than one buffer
+  uint64_t gathered_sends; // sendmsgs that echoed more than one buffer
+  sig_atomic_t dump_gen;  // last stats_dump_gen this worker dumped
+  int id;
+} server_stats_t;
+#endif
+
 struct server_t {
-  struct io_uring ring;               // the ring
-  struct io_uring_buf_ring *buf_ring; // ring mapped buffer
-  io_event_cb ev_handlers[4];         // completion queue entry handlers
+  struct io_uring ring;              // the ring
+  buf_group_t groups[BG_COUNT];      // provided buffer rings indexed by bgid
+  io_event_cb ev_handlers[EV_COUNT]; // completion queue entry handlers
+  conn_t *conns;        // connection state indexed by direct descriptor
+  int (*conn_pipes)[2]; // splice mode: each connection's pipe, by descriptor
+  pipe_pool_t pipes;    // splice mode: pipes of closed connections
+  buf_meta_t *buf_meta; // buffer state of every group's buffers
+  uint32_t nmeta;       // entries in buf_meta, buffers and slices
+  uint32_t free_slices; // -i: unused slices chained through next
+  send_msg_t *send_msgs; // bundle mode: sendmsg headers, indexed by sqe
+  bp_stats_t bp;        // buffer starvation counters
+  int listen_fd;        // listener the multishot accept is posted on
+  int acceptor;         // -A: the ring passes its accepts on to the workers
+  worker_link_t *link;  // -A: the worker's link, NULL on the acceptor
+  uint32_t live_conns;  // accepted connections whose slot is not closed yet
+  uint64_t cq_overflows; // loop iterations that found the cq overflowed
+  uint64_t zc_copied;    // zero-copy sends the kernel fell back to copying
+  tw_wheel_t wheel;      // -T: every connection's idle timer
+  struct __kernel_timespec tick_ts; // -T: period of the multishot timeout
+  uint64_t idle_closed;  // connections closed for being idle
+#ifdef SERVER_STATS
+  server_stats_t stats;
+#endif
 };
 
-void server_register_buf_ring(server_t *s);
+// runtime configuration, filled in by main before any worker starts and
+// treated as read-only afterwards
+typedef struct {
+  int port;
+  int threads;           // number of workers, each owns a ring and listener
+  int ncpus;             // number of entries in cpus, 0 means no pinning
+  int cpus[MAX_THREADS]; // worker i is pinned to cpus[i % ncpus]
+  int recv_multishot;    // keep one multishot recv posted per connection
+  uint32_t high_watermark; // queued bytes at which receiving pauses
+  uint32_t zc_threshold;   // sends of at least this many bytes go zero-copy,
+                           // 0 disables zero-copy sends
+  int fixed_bufs;          // register every provided buffer and send from the
+                           // registered copy, its index is the buf_meta index
+  int splice;              // echo through a pipe per connection with splice
+  int bundles;             // recv bundles and gathered sends
+  int inc_bufs;            // let recvs consume buffers incrementally
+  uint32_t busy_poll_usecs; // NAPI busy poll time per wait, 0 disables it
+  int prefer_busy_poll;      // keep the device irqs masked while polling
+  int sqpoll;               // submit through a kernel sq polling thread
+  int nsq_cpus;             // number of entries in sq_cpus, 0: no pinning
+  int sq_cpus[MAX_THREADS]; // worker i's poller is pinned to sq_cpus[i % n]
+  uint32_t sq_idle_ms;      // idle time before the poller goes to sleep
+  int acceptor;             // accept on one ring and pass connections on
+  int acceptor_cpu;         // cpu the acceptor ring's thread is pinned to
+  uint32_t idle_ticks;      // ticks without data moving before a connection
+                            // is closed, 0 disables the idle timeouts
+  int huge_pages;           // back the buffer arenas by huge pages
+  uint32_t max_conns;      // size of each worker's direct descriptor table
+  uint32_t sq_depth;
+  uint32_t cq_depth;
+} server_config_t;
+
+static server_config_t cfg = {.port = DEFAULT_PORT,
+                              .threads = 1,
+                              .high_watermark = SENDQ_HIGH_WATERMARK,
+                              .max_conns = DEFAULT_MAX_CONNS,
+                              .sq_depth = DEFAULT_SQ_DEPTH,
+                              .cq_depth = DEFAULT_CQ_DEPTH,
+                              .sq_idle_ms = DEFAULT_SQ_IDLE_MS};
+
+static worker_link_t worker_links[MAX_THREADS];
+static pthread_barrier_t rings_ready; // -A: every worker published its ring
+static uint32_t acceptor_passed[MAX_THREADS]; // -A: passes per worker, only
+                                              // touched by the acceptor
+static uint32_t acceptor_next; // -A: where the next least loaded scan starts
+
+static void *server_run(void *arg);
+
+static void acceptor_run(void);
+
+static uint32_t raise_nofile_limit(uint32_t want);
+
+static void raise_memlock_limit(void);
+
+void server_register_buf_ring(server_t *s, uint32_t bgid);
+
+static int server_grow_buf_group(server_t *s, uint32_t bgid);
+
+static int server_register_fixed_bufs(server_t *s, uint32_t bgid,
+                                      uint32_t first, uint32_t n);
+
+static void server_on_enobufs(server_t *s, uint32_t fd, uint32_t bgid);
 
 int server_socket_bind_listen(int port, int sockopts);
 
 static void server_add_multishot_accept(server_t *s, int listener_fd);
 
+static void server_pass_conn(server_t *s, uint32_t fd);
+
 static void server_add_recv(server_t *s, int fd);
 
+static void server_add_splice_in(server_t *s, uint32_t fd);
+
+static void server_add_splice_out(server_t *s, uint32_t fd, uint32_t len);
+
 static inline void server_add_send(server_t *s, uint64_t *ctx,
                                    const void *data, size_t len,
                                    uint32_t sqe_flags, uint32_t send_flags);
 
 static void server_add_close_direct(server_t *s, uint32_t fd);
 
+static void server_add_shutdown(server_t *s, uint32_t fd);
+
+#ifdef HAVE_TIMEOUT_MULTISHOT
+static void server_add_tick_timeout(server_t *s);
+#endif
+
+static void server_add_cancel_recv(server_t *s, uint32_t fd);
+
+static inline void conn_sendq_push(server_t *s, uint32_t fd, uint32_t ref,
+                                   uint32_t len);
+
+static void conn_recv_bufs(server_t *s, uint32_t fd, uint32_t bgid,
+                           uint32_t bid, uint32_t len);
+
+static void conn_recv_slice(server_t *s, uint32_t fd, uint32_t bgid,
+                            uint32_t bid, struct io_uring_cqe *cqe);
+
+static inline int conn_update_bgid(server_t *s, uint32_t fd, uint32_t bgid,
+                                   uint32_t len);
+
+static inline void conn_send_next(server_t *s, uint32_t fd);
+
+static void conn_send_bundle(server_t *s, uint32_t fd);
+
+static void conn_maybe_close(server_t *s, uint32_t fd);
+
+static void conn_park(server_t *s, uint32_t fd, uint32_t bgid);
+
+static void conn_unpark(server_t *s, uint32_t fd);
+
 static void on_accept(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe);
 
 static void on_read(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe);
 
 static void on_write(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe);
 
+static void on_write_zc(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe);
+
 static void on_close(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe);
 
+static void on_cancel(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe);
+
+static void on_splice_in(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe);
+
+static void on_splice_out(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe);
+
+static void on_timeout(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe);
+
+static void conn_on_idle(void *arg, tw_timer_t *t);
+
+static inline uint64_t idle_now(void);
+
 static inline unsigned char *server_get_selected_buffer(server_t *s,
+                                                        uint32_t bgid,
                                                         uint32_t buf_idx);
 
-static inline int server_conn_get_bgid(server_t *s);
+static inline int server_conn_get_bgid(server_t *s, uint32_t fd);
 
-static inline void server_recycle_buff(server_t *s, void *buf,
+static inline void server_recycle_buff(server_t *s, uint32_t bgid,
                                        uint32_t buf_idx);
 
+static inline void server_release_buff(server_t *s, buf_meta_t *m);
+
+static void server_flush_bufs(server_t *s);
+
+static uint32_t server_slice_alloc(server_t *s);
+
 struct io_uring_sqe *must_get_sqe(server_t *s);
 
+#ifdef SERVER_STATS
+static void server_stats_dump(server_t *s);
+#endif
+
 
 static inline void conn_set_fd(uint64_t *data, uint32_t fd);
 static inline void conn_set_bgid(uint64_t *data, uint32_t index);
@@ -107,35 +427,419 @@ static inline uint8_t conn_get_event(uint64_t data);
 
 // ---------------------------------------------------------------------
 
-int main(void) {
-  int fd = server_socket_bind_listen(9919, SO_REUSEADDR);
-  printf("io_uring backed TCP echo server starting on port: %d\n", 9919);
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -p port      port to listen on (default %d)\n"
+          "  -t threads   number of ring-per-core workers (default 1)\n"
+          "  -c cpu-list  cpus to pin workers to, e.g. 2,3,8-11\n"
+          "  -m           use multishot recvs instead of one-shot recvs\n"
+          "  -w bytes     per connection send queue high watermark "
+          "(default %d)\n"
+          "  -n conns     max connections per worker (default %d)\n"
+          "  -q entries   sq depth (default %d)\n"
+          "  -Q entries   cq depth (default %d)\n"
+          "  -z bytes     send zero-copy from this many bytes on "
+          "(default off)\n"
+          "  -f           register the buffers and send from fixed buffers\n"
+          "  -s           echo through a pipe with splice\n"
+          "  -u           receive bundles of buffers and gather sends\n"
+          "  -i           share buffers between recvs, consumed incrementally\n"
+          "  -b usecs     busy poll the NIC for up to usecs per wait "
+          "(default off)\n"
+          "  -P           prefer busy polling over device interrupts\n"
+          "  -S cpu-list  submit through sqpoll threads pinned to these cpus, "
+          "e.g. 4-7\n"
+          "  -I msecs     sqpoll thread idle time before it sleeps "
+          "(default %d)\n"
+          "  -A cpu       accept on one ring pinned to cpu, it passes every "
+          "connection\n"
+          "               to the worker with the fewest live connections\n"
+          "  -T secs      close connections that moved no data for secs "
+          "(default off)\n"
+          "  -H           back the buffer arenas by huge pages\n",
+          prog, DEFAULT_PORT, SENDQ_HIGH_WATERMARK, DEFAULT_MAX_CONNS,
+          DEFAULT_SQ_DEPTH, DEFAULT_CQ_DEPTH, DEFAULT_SQ_IDLE_MS);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  int threads = 0;
+  while ((opt = getopt(argc, argv, "p:t:c:mw:n:q:Q:z:fsuib:PS:I:A:T:Hh")) != -1) {
+    switch (opt) {
+    case 'p':
+      cfg.port = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'c':
+      cfg.ncpus = parse_cpu_list(optarg, cfg.cpus, MAX_THREADS);
+      if (cfg.ncpus <= 0) {
+        fprintf(stderr, "invalid cpu list: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'm':
+      cfg.recv_multishot = 1;
+      break;
+    case 'w':
+      cfg.high_watermark = strtoul(optarg, NULL, 10);
+      if (cfg.high_watermark == 0) {
+        fprintf(stderr, "invalid high watermark: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'n':
+      cfg.max_conns = strtoul(optarg, NULL, 10);
+      if (cfg.max_conns == 0 || cfg.max_conns > MAX_CONNS) {
+        fprintf(stderr, "max connections must be between 1 and %d\n",
+                MAX_CONNS);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'q':
+      cfg.sq_depth = strtoul(optarg, NULL, 10);
+      break;
+    case 'Q':
+      cfg.cq_depth = strtoul(optarg, NULL, 10);
+      break;
+    case 'z':
+      cfg.zc_threshold = strtoul(optarg, NULL, 10);
+      break;
+    case 'f':
+      cfg.fixed_bufs = 1;
+      break;
+    case 's':
+      cfg.splice = 1;
+      break;
+    case 'u':
+      cfg.bundles = 1;
+      break;
+    case 'i':
+      cfg.inc_bufs = 1;
+      break;
+    case 'b':
+      cfg.busy_poll_usecs = strtoul(optarg, NULL, 10);
+      break;
+    case 'P':
+      cfg.prefer_busy_poll = 1;
+      break;
+    case 'S':
+      cfg.sqpoll = 1;
+      cfg.nsq_cpus = parse_cpu_list(optarg, cfg.sq_cpus, MAX_THREADS);
+      if (cfg.nsq_cpus <= 0) {
+        fprintf(stderr, "invalid cpu list: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'I':
+      cfg.sq_idle_ms = strtoul(optarg, NULL, 10);
+      break;
+    case 'A':
+      cfg.acceptor = 1;
+      cfg.acceptor_cpu = atoi(optarg);
+      break;
+    case 'T':
+      cfg.idle_ticks = strtoul(optarg, NULL, 10) * 1000 / IDLE_TICK_MS;
+      if (cfg.idle_ticks == 0) {
+        fprintf(stderr, "invalid idle timeout: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'H':
+      cfg.huge_pages = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  // without an explicit thread count run one worker per listed cpu
+  cfg.threads = threads ? threads : (cfg.ncpus ? cfg.ncpus : 1);
+  if (cfg.threads < 1 || cfg.threads > MAX_THREADS) {
+    fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+
+  if (cfg.sq_depth == 0 || cfg.cq_depth < cfg.sq_depth) {
+    fprintf(stderr, "sq depth must be non-zero and at most the cq depth\n");
+    return EXIT_FAILURE;
+  }
+
+  if (cfg.zc_threshold) {
+    struct io_uring_probe *probe = io_uring_get_probe();
+    int supported =
+        probe && io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
+    io_uring_free_probe(probe);
+    if (!supported) {
+      fprintf(stderr, "zero-copy sends are not supported by this kernel\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  // the splice path never touches the provided buffers
+  if (cfg.splice && (cfg.recv_multishot || cfg.zc_threshold || cfg.fixed_bufs)) {
+    fprintf(stderr, "splice can't be combined with -m, -z or -f\n");
+    return EXIT_FAILURE;
+  }
+
+  // a poller spinning next to its worker halves the worker's core
+  for (int i = 0; i < cfg.nsq_cpus; ++i) {
+    for (int j = 0; j < cfg.ncpus; ++j) {
+      if (cfg.sq_cpus[i] == cfg.cpus[j]) {
+        fprintf(stderr, "[warning]: cpu %d runs both a worker and a poller\n",
+                cfg.sq_cpus[i]);
+      }
+    }
+  }
+  for (int j = 0; cfg.acceptor && j < cfg.ncpus; ++j) {
+    if (cfg.acceptor_cpu == cfg.cpus[j]) {
+      fprintf(stderr, "[warning]: cpu %d runs both a worker and the acceptor\n",
+              cfg.acceptor_cpu);
+    }
+  }
+
+  // the gathered sends are plain sendmsgs, and a bundle's buffers are found
+  // through ring positions that a concurrently running poller may reuse
+  if (cfg.bundles && (cfg.splice || cfg.zc_threshold || cfg.fixed_bufs ||
+                      cfg.sqpoll)) {
+    fprintf(stderr, "bundles can't be combined with -s, -z, -f or -S\n");
+    return EXIT_FAILURE;
+  }
+
+#ifndef HAVE_BUNDLES
+  if (cfg.bundles) {
+    fprintf(stderr, "bundles need kernel headers from 6.10 or newer\n");
+    return EXIT_FAILURE;
+  }
+#endif
+
+  // slices are released by their send, not by a buffer's zero-copy
+  // notification, and a bundle's buffers would have to be sliced as well
+  if (cfg.inc_bufs && (cfg.splice || cfg.zc_threshold || cfg.bundles)) {
+    fprintf(stderr, "-i can't be combined with -s, -z or -u\n");
+    return EXIT_FAILURE;
+  }
+
+#ifndef HAVE_PBUF_INC
+  if (cfg.inc_bufs) {
+    fprintf(stderr, "-i needs kernel headers from 6.12 or newer\n");
+    return EXIT_FAILURE;
+  }
+#endif
+
+#ifndef HAVE_TIMEOUT_MULTISHOT
+  if (cfg.idle_ticks) {
+    fprintf(stderr, "idle timeouts need kernel headers from 6.4 or newer\n");
+    return EXIT_FAILURE;
+  }
+#endif
+
+#ifndef HAVE_NAPI
+  if (cfg.busy_poll_usecs) {
+    fprintf(stderr, "busy polling needs liburing 2.6 or newer\n");
+    return EXIT_FAILURE;
+  }
+#endif
+
+  // a sparse file table can't be larger than RLIMIT_NOFILE
+  uint32_t limit = raise_nofile_limit(cfg.max_conns);
+  if (limit < cfg.max_conns) {
+    fprintf(stderr,
+            "[warning]: RLIMIT_NOFILE only allows %u connections per worker\n",
+            limit);
+    cfg.max_conns = limit;
+  }
+
+  // registered buffers are pinned and count against RLIMIT_MEMLOCK
+  if (cfg.fixed_bufs) {
+    raise_memlock_limit();
+  }
+
+  // -f echoes through writes, which unlike sends raise SIGPIPE on a
+  // connection that was shut down
+  signal(SIGPIPE, SIG_IGN);
+#ifdef SERVER_STATS
+  stats_install_handler();
+#endif
+
+  printf("io_uring backed TCP echo server starting on port: %d "
+         "(%d worker%s%s)\n",
+         cfg.port, cfg.threads, cfg.threads > 1 ? "s" : "",
+         cfg.acceptor ? " behind an acceptor ring" : "");
+
+  if (cfg.threads == 1 && !cfg.acceptor) {
+    server_run((void *)0);
+    return 0;
+  }
+
+  if (cfg.acceptor) {
+    assert(pthread_barrier_init(&rings_ready, NULL, cfg.threads + 1) == 0);
+  }
+
+  pthread_t workers[MAX_THREADS];
+  for (intptr_t i = 0; i < cfg.threads; ++i) {
+    assert(pthread_create(&workers[i], NULL, server_run, (void *)i) == 0);
+  }
+
+  if (cfg.acceptor) {
+    acceptor_run();
+  }
+
+  for (int i = 0; i < cfg.threads; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+
+  return 0;
+}
+
+// each worker is fully independent: it owns a SO_REUSEPORT listener, a ring,
+// a sparse fixed-file table and a buffer ring, the kernel spreads incoming
+// connections across the listeners so no state is ever shared between threads
+// with -A the workers have no listener, the acceptor ring passes connections
+// into their file tables instead
+static void *server_run(void *arg) {
+  int id = (int)(intptr_t)arg;
+  if (cfg.ncpus) {
+    pin_to_cpu(cfg.cpus[id % cfg.ncpus]);
+  }
+
+  int fd = -1;
+  if (!cfg.acceptor) {
+    fd = server_socket_bind_listen(
+        cfg.port, cfg.threads > 1 ? SO_REUSEPORT : SO_REUSEADDR);
+  }
 
   server_t s;
   memset(&s, 0, sizeof s);
+#ifdef SERVER_STATS
+  s.stats.id = id;
+  s.stats.dump_gen = stats_dump_gen;
+#endif
 
   s.ev_handlers[EV_ACCEPT] = on_accept;
   s.ev_handlers[EV_RECV] = on_read;
   s.ev_handlers[EV_SEND] = on_write;
   s.ev_handlers[EV_CLOSE] = on_close;
+  s.ev_handlers[EV_CANCEL] = on_cancel;
+  s.ev_handlers[EV_SEND_ZC] = on_write_zc;
+  s.ev_handlers[EV_SPLICE_IN] = on_splice_in;
+  s.ev_handlers[EV_SPLICE_OUT] = on_splice_out;
+  s.ev_handlers[EV_TIMEOUT] = on_timeout;
+
+  uint32_t nbufs = 0;
+  for (int i = 0; i < BG_COUNT; ++i) {
+    nbufs += buf_classes[i].entries * BG_MAX_GROWTH;
+  }
+  assert(nbufs < BUF_NONE);
+
+  s.conns = calloc(cfg.max_conns, sizeof *s.conns);
+  s.buf_meta = calloc(nbufs, sizeof *s.buf_meta);
+  s.nmeta = nbufs;
+  s.free_slices = BUF_NONE;
+  assert(s.conns != NULL && s.buf_meta != NULL);
+  if (cfg.splice) {
+    s.conn_pipes = calloc(cfg.max_conns, sizeof *s.conn_pipes);
+    assert(s.conn_pipes != NULL);
+  }
 
   struct io_uring_params params;
   assert(memset(&params, 0, sizeof(params)) != NULL);
 
   params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_DEFER_TASKRUN |
-                 IORING_SETUP_SINGLE_ISSUER;
+                 IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_CQSIZE |
+                 IORING_SETUP_CLAMP;
+  params.cq_entries = cfg.cq_depth;
+  if (cfg.sqpoll) {
+    // the poller thread issues the requests and runs their task work, the
+    // flags that defer task work to the submitter are rejected with it
+    params.flags = IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF |
+                   IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_CQSIZE |
+                   IORING_SETUP_CLAMP;
+    params.sq_thread_cpu = cfg.sq_cpus[id % cfg.nsq_cpus];
+    params.sq_thread_idle = cfg.sq_idle_ms;
+  }
 
-  assert(io_uring_queue_init_params(SQ_DEPTH, &s.ring, &params) == 0);
-  assert(io_uring_register_files_sparse(&s.ring, FD_COUNT) == 0);
+  assert(io_uring_queue_init_params(cfg.sq_depth, &s.ring, &params) == 0);
+  assert(io_uring_register_files_sparse(&s.ring, cfg.max_conns) == 0);
   assert(io_uring_register_ring_fd(&s.ring) == 1);
+#ifdef HAVE_BUNDLES
+  if (cfg.bundles && !(params.features & IORING_FEAT_RECVSEND_BUNDLE)) {
+    fprintf(stderr, "bundles are not supported by this kernel\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+  if (cfg.bundles) {
+    s.send_msgs = calloc(s.ring.sq.ring_entries, sizeof *s.send_msgs);
+    assert(s.send_msgs != NULL);
+  }
+  if (cfg.fixed_bufs) {
+    // slots are filled in as the buffer groups grow
+    assert(io_uring_register_buffers_sparse(&s.ring, nbufs) == 0);
+  }
+#ifdef HAVE_NAPI
+  if (cfg.busy_poll_usecs) {
+    // the ring learns the napi id of every socket it sees a request for and
+    // spins on those queues in io_uring_enter before going to sleep
+    struct io_uring_napi napi = {.busy_poll_to = cfg.busy_poll_usecs,
+                                 .prefer_busy_poll = cfg.prefer_busy_poll};
+    int ret = io_uring_register_napi(&s.ring, &napi);
+    if (ret < 0) {
+      fprintf(stderr, "io_uring_register_napi: %s\n", strerror(-ret));
+      exit(EXIT_FAILURE);
+    }
+  }
+#endif
 
-  server_register_buf_ring(&s);
-  server_add_multishot_accept(&s, fd);
+  for (uint32_t bgid = 0; bgid < BG_COUNT; ++bgid) {
+    if (!cfg.inc_bufs || bgid == BG_INC) {
+      server_register_buf_ring(&s, bgid);
+    }
+  }
+#ifdef HAVE_TIMEOUT_MULTISHOT
+  if (cfg.idle_ticks) {
+    s.wheel.now = idle_now();
+    server_add_tick_timeout(&s);
+  }
+#endif
+
+  s.listen_fd = fd;
+  if (cfg.acceptor) {
+    s.link = &worker_links[id];
+    s.link->ring_fd = s.ring.ring_fd;
+    pthread_barrier_wait(&rings_ready);
+  } else {
+    server_add_multishot_accept(&s, fd);
+  }
 
   for (;;) {
     // printf("start loop iteration\n");
-    int ret = io_uring_submit_and_wait(&s.ring, 1);
-    assert(ret >= 0); // todo(sah): handle more gracefully
+    int ret;
+    if (!cfg.sqpoll) {
+      ret = io_uring_submit_and_wait(&s.ring, 1);
+    } else {
+      // publishing the sq tail is enough while the poller is awake,
+      // io_uring_submit only enters the kernel to wake it once it has set
+      // IORING_SQ_NEED_WAKEUP, and waiting only enters when the cq is empty
+#ifdef SERVER_STATS
+      if (__atomic_load_n(s.ring.sq.kflags, __ATOMIC_ACQUIRE) &
+          IORING_SQ_NEED_WAKEUP) {
+        s.stats.sq_wakeups++;
+      }
+#endif
+      ret = io_uring_submit(&s.ring);
+      if (ret >= 0 && !io_uring_cq_ready(&s.ring)) {
+        struct io_uring_cqe *cqe;
+        ret = io_uring_wait_cqe(&s.ring, &cqe);
+      }
+    }
+    if (UNLIKELY(ret < 0) && ret != -EINTR && ret != -EBUSY &&
+        ret != -EAGAIN) {
+      fprintf(stderr, "io_uring_submit_and_wait: %s\n", strerror(-ret));
+      exit(1);
+    }
 
     // printf("io_uring_submit_and_wait: %d\n", ret);
     struct io_uring_cqe *cqe;
@@ -147,50 +851,264 @@ int main(void) {
       uint64_t ctx = io_uring_cqe_get_data64(cqe);
       uint8_t ev = conn_get_event(ctx);
 
+      STATS_TIME_START(t0);
       s.ev_handlers[ev](&s, ctx, cqe);
+      STATS_TIME_END(s.stats.handler_ns[ev], t0);
     };
 
-    // printf("end loop iteration cqes seen %d\n", i);
     io_uring_cq_advance(&s.ring, i);
+    STATS_HIST(s.stats.cqes_per_wait, i);
+
+    // a bundle's buffers are looked up by their ring position, the ring may
+    // only be written once no completion that consumed buffers is left
+    // unseen, which the overflow list could still hold
+    if (!cfg.bundles || !io_uring_cq_has_overflow(&s.ring)) {
+      server_flush_bufs(&s);
+    }
+#ifdef SERVER_STATS
+    if (UNLIKELY(s.stats.dump_gen != stats_dump_gen)) {
+      s.stats.dump_gen = stats_dump_gen;
+      server_stats_dump(&s);
+    }
+#endif
+
+    // completions that did not fit the cq wait on the kernel's overflow list
+    // (multishot requests that overflowed have terminated and get re-armed by
+    // their handlers), flush them into the cq now that it has room again
+    if (UNLIKELY(io_uring_cq_has_overflow(&s.ring))) {
+      uint64_t n = ++s.cq_overflows;
+      if (!(n & (n - 1))) {
+        fprintf(stderr, "cq overflowed %lu times\n", n);
+      }
+      io_uring_get_events(&s.ring);
+    }
   }
 
   printf("exiting event loop\n");
   io_uring_queue_exit(&s.ring);
 
-  close(fd);
+  free(s.conns);
+  free(s.conn_pipes);
+  free(s.buf_meta);
+  free(s.send_msgs);
+  if (fd >= 0) {
+    close(fd);
+  }
 
-  return 0;
+  return NULL;
+}
+
+// -A: one ring owns the listener and hands every connection it accepts to a
+// worker ring, the direct descriptor moves from the acceptor's file table
+// into the worker's so a connection only ever touches its worker's state.
+// this evens out the load where the reuseport hash would pile a few heavy
+// clients onto the same worker
+static void acceptor_run(void) {
+  pin_to_cpu(cfg.acceptor_cpu);
+
+  server_t s;
+  memset(&s, 0, sizeof s);
+  s.acceptor = 1;
+  s.ev_handlers[EV_ACCEPT] = on_accept;
+  s.ev_handlers[EV_CLOSE] = on_close;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_DEFER_TASKRUN |
+                 IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_CQSIZE;
+  params.cq_entries = ACCEPTOR_SQ_DEPTH * 4;
+
+  uint32_t slots =
+      cfg.max_conns < ACCEPTOR_SLOTS ? cfg.max_conns : ACCEPTOR_SLOTS;
+  assert(io_uring_queue_init_params(ACCEPTOR_SQ_DEPTH, &s.ring, &params) == 0);
+  assert(io_uring_register_files_sparse(&s.ring, slots) == 0);
+  assert(io_uring_register_ring_fd(&s.ring) == 1);
+
+  s.listen_fd = server_socket_bind_listen(cfg.port, SO_REUSEADDR);
+  pthread_barrier_wait(&rings_ready);
+  server_add_multishot_accept(&s, s.listen_fd);
+
+  for (;;) {
+    int ret = io_uring_submit_and_wait(&s.ring, 1);
+    if (UNLIKELY(ret < 0) && ret != -EINTR && ret != -EBUSY &&
+        ret != -EAGAIN) {
+      fprintf(stderr, "io_uring_submit_and_wait: %s\n", strerror(-ret));
+      exit(1);
+    }
+
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    unsigned i = 0;
+    io_uring_for_each_cqe(&s.ring, head, cqe) {
+      ++i;
+      uint64_t ctx = io_uring_cqe_get_data64(cqe);
+      s.ev_handlers[conn_get_event(ctx)](&s, ctx, cqe);
+    }
+    io_uring_cq_advance(&s.ring, i);
+
+    if (UNLIKELY(io_uring_cq_has_overflow(&s.ring))) {
+      io_uring_get_events(&s.ring);
+    }
+  }
+}
+
+// raises the soft RLIMIT_NOFILE to at least want if the hard limit allows,
+// returns the resulting soft limit
+static uint32_t raise_nofile_limit(uint32_t want) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+    return want;
+  }
+
+  if (rl.rlim_cur < want) {
+    rl.rlim_cur = rl.rlim_max < want ? rl.rlim_max : want;
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+      getrlimit(RLIMIT_NOFILE, &rl);
+    }
+  }
+
+  return rl.rlim_cur < want ? (uint32_t)rl.rlim_cur : want;
+}
+
+static void raise_memlock_limit(void) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_MEMLOCK, &rl);
+  }
 }
 
 // ---------------------------------------------------------------------
 
-void server_register_buf_ring(server_t *s) {
-  struct io_uring_buf_reg reg = {
-      .ring_addr = 0, .ring_entries = BG_ENTRIES, .bgid = 0};
+// the group's ring is registered at its maximum size while only the initial
+// buffers are populated and handed to the kernel, the rest of the arena is
+// reserved address space that server_grow_buf_group fills in on demand
+void server_register_buf_ring(server_t *s, uint32_t bgid) {
+  buf_group_t *g = &s->groups[bgid];
+  g->buf_size = buf_classes[bgid].buf_size;
+  g->max_entries = buf_classes[bgid].entries * BG_MAX_GROWTH;
+  g->meta_base = bgid ? s->groups[bgid - 1].meta_base +
+                            s->groups[bgid - 1].max_entries
+                      : 0;
+  g->wait_head = g->wait_tail = CONN_NONE;
+  g->pending = calloc(g->max_entries, sizeof *g->pending);
+  g->bid_pos = calloc(g->max_entries, sizeof *g->bid_pos);
+  assert(g->pending != NULL && g->bid_pos != NULL);
+  assert(!(g->max_entries & (g->max_entries - 1)));
 
-  void *mbr = mmap(NULL, (sizeof(struct io_uring_buf) + BUFF_CAP) * BG_ENTRIES,
-                   PROT_READ | PROT_WRITE,
-                   MAP_ANON | MAP_PRIVATE | MAP_POPULATE, -1, 0);
+  struct io_uring_buf_reg reg = {
+      .ring_addr = 0, .ring_entries = g->max_entries, .bgid = bgid};
+
+  // a pinned worker's arena is bound to its numa node before the first
+  // buffers are populated
+  size_t ring_size = sizeof(struct io_uring_buf) * g->max_entries;
+  void *mbr = arena_map(ring_size + (size_t)g->buf_size * g->max_entries,
+                        ARENA_NORESERVE | (cfg.huge_pages ? ARENA_HUGE : 0) |
+                            (cfg.ncpus ? ARENA_NUMA : 0));
   assert(mbr != MAP_FAILED);
 
-  s->buf_ring = (struct io_uring_buf_ring *)mbr;
+  g->br = (struct io_uring_buf_ring *)mbr;
+  g->bufs = (unsigned char *)mbr + ring_size;
+
+  io_uring_buf_ring_init(g->br);
 
-  io_uring_buf_ring_init(s->buf_ring);
+  reg.ring_addr = (unsigned long)g->br;
+#ifdef HAVE_PBUF_INC
+  if (cfg.inc_bufs) {
+    // a recv takes only the bytes it needs from the head buffer, which stays
+    // at the head for the next recv until it is full
+    reg.flags = IOU_PBUF_RING_INC;
+  }
+#endif
 
-  reg.ring_addr = (unsigned long)s->buf_ring;
+  int ret = io_uring_register_buf_ring(&s->ring, &reg, 0);
+  if (ret != 0 && cfg.inc_bufs) {
+    fprintf(stderr, "incremental buffer consumption: %s\n", strerror(-ret));
+    exit(EXIT_FAILURE);
+  }
+  assert(ret == 0);
 
-  assert(io_uring_register_buf_ring(&s->ring, &reg, 0) == 0);
+  for (uint32_t i = 0; i < g->max_entries; ++i) {
+    buf_meta_t *m = &s->buf_meta[g->meta_base + i];
+    m->bgid = bgid;
+    m->bid = i;
+  }
 
-  unsigned char *buf_addr;
-  for (size_t i = 0; i < BG_ENTRIES; ++i) {
-    buf_addr = (unsigned char *)s->buf_ring + BUF_BASE_OFFSET + (i * BUFF_CAP);
-    io_uring_buf_ring_add(s->buf_ring, buf_addr, BUFF_CAP, i,
-                          io_uring_buf_ring_mask(BG_ENTRIES), i);
+  g->entries = 0;
+  assert(server_grow_buf_group(s, bgid));
+  server_flush_bufs(s);
+}
 
-    assert(server_get_selected_buffer(s, i) == buf_addr);
+// queues the next batch of the group's reserved buffers for the kernel,
+// doubling the group (the first call adds the initial buffers), returns 0
+// once the group is at its maximum size
+static int server_grow_buf_group(server_t *s, uint32_t bgid) {
+  buf_group_t *g = &s->groups[bgid];
+  uint32_t n = g->entries ? g->entries : buf_classes[bgid].entries;
+  if (g->entries + n > g->max_entries) {
+    return 0;
   }
 
-  io_uring_buf_ring_advance(s->buf_ring, BG_ENTRIES);
+  unsigned char *start = g->bufs + ((size_t)g->entries * g->buf_size);
+#ifdef MADV_POPULATE_WRITE
+  madvise(start, (size_t)n * g->buf_size, MADV_POPULATE_WRITE);
+#endif
+  if (cfg.fixed_bufs && !server_register_fixed_bufs(s, bgid, g->entries, n)) {
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < n; ++i) {
+    g->pending[g->npending++] = g->entries + i;
+  }
+  g->entries += n;
+  return 1;
+}
+
+// registers buffers first..first+n-1 of the group, each buffer gets its own
+// slot in the registered buffer table at its buf_meta index, returns 0 if
+// the kernel refused to pin them (e.g. RLIMIT_MEMLOCK)
+static int server_register_fixed_bufs(server_t *s, uint32_t bgid,
+                                      uint32_t first, uint32_t n) {
+  buf_group_t *g = &s->groups[bgid];
+  struct iovec *iov = malloc(n * sizeof *iov);
+  assert(iov != NULL);
+  for (uint32_t i = 0; i < n; ++i) {
+    iov[i].iov_base = server_get_selected_buffer(s, bgid, first + i);
+    iov[i].iov_len = g->buf_size;
+  }
+
+  int ret = io_uring_register_buffers_update_tag(&s->ring, g->meta_base + first,
+                                                 iov, NULL, n);
+  free(iov);
+  if (ret < 0) {
+    fprintf(stderr, "registering %u buffers of group %u: %s\n", n, bgid,
+            strerror(-ret));
+    return 0;
+  }
+  return 1;
+}
+
+// a recv of fd found group bgid empty: grow the group if it still can,
+// otherwise park the connection until a buffer is recycled into the group
+static void server_on_enobufs(server_t *s, uint32_t fd, uint32_t bgid) {
+  conn_t *c = &s->conns[fd];
+  uint64_t n = ++s->bp.enobufs;
+  if (!(n & (n - 1))) {
+    fprintf(stderr,
+            "buffer starvation: enobufs=%lu grown=%lu parked=%lu woken=%lu\n",
+            s->bp.enobufs, s->bp.grown, s->bp.parked, s->bp.woken);
+  }
+
+  if (c->closing) {
+    conn_maybe_close(s, fd);
+  } else if (server_grow_buf_group(s, bgid)) {
+    s->bp.grown++;
+    fprintf(stderr, "buffer group %u grown to %u buffers of %u bytes\n", bgid,
+            s->groups[bgid].entries, s->groups[bgid].buf_size);
+    server_add_recv(s, fd);
+  } else {
+    conn_park(s, fd, bgid);
+  }
 }
 
 int server_socket_bind_listen(int port, int sockopts) {
@@ -211,27 +1129,129 @@ int server_socket_bind_listen(int port, int sockopts) {
   return fd;
 }
 
+// buffers are recycled into whatever ring slot is at the tail, so a slot's
+// addr says nothing about the buffer id it was handed out under anymore,
+// the address is derived from the id instead
 static inline unsigned char *server_get_selected_buffer(server_t *s,
+                                                        uint32_t bgid,
                                                         uint32_t buf_idx) {
-  return (unsigned char *)s->buf_ring->bufs[buf_idx].addr;
+  buf_group_t *g = &s->groups[bgid];
+  return g->bufs + ((size_t)buf_idx * g->buf_size);
 }
 
-static inline int server_conn_get_bgid(server_t *s) { return 0; }
+static inline int server_conn_get_bgid(server_t *s, uint32_t fd) {
+  return s->conns[fd].bgid;
+}
 
-static inline void server_recycle_buff(server_t *s, void *buf,
+static inline void server_recycle_buff(server_t *s, uint32_t bgid,
                                        uint32_t buf_idx) {
+  buf_group_t *g = &s->groups[bgid];
+  STATS_INC(s->stats.recycled);
+  g->pending[g->npending++] = buf_idx;
+
+  // every returned buffer lets one starved connection try again
+  if (UNLIKELY(g->wait_head != CONN_NONE)) {
+    uint32_t fd = g->wait_head;
+    conn_unpark(s, fd);
+    if (!s->conns[fd].paused) {
+      s->bp.woken++;
+      server_add_recv(s, fd);
+    }
+  }
+}
 
-  io_uring_buf_ring_add(s->buf_ring, buf, BUFF_CAP, buf_idx,
-                        io_uring_buf_ring_mask(BG_ENTRIES), 0);
+// hands a buffer that left the send queue back to its group, unless
+// zero-copy sends of it are still pinned, then the last notification does
+static inline void server_release_buff(server_t *s, buf_meta_t *m) {
+  if (cfg.inc_bufs) {
+    // a slice, the buffer it points into goes back once nothing refers to it
+    buf_meta_t *b = &s->buf_meta[s->groups[m->bgid].meta_base + m->bid];
+    m->next = s->free_slices;
+    s->free_slices = m - s->buf_meta;
+    if (--b->refs == 0) {
+      server_recycle_buff(s, b->bgid, b->bid);
+    }
+    return;
+  }
 
-  io_uring_buf_ring_advance(s->buf_ring, 1);
+  if (UNLIKELY(m->zc_notifs)) {
+    m->released = 1;
+    return;
+  }
+  server_recycle_buff(s, m->bgid, m->bid);
+}
+
+// writes the buffers recycled since the last flush to their rings and
+// publishes them with a single tail update per group. the kernel only reads
+// entries below the tail, and io_uring_buf_ring_advance stores the tail
+// after the entries, so the flush is safe while buffers are being consumed.
+// with the task work deferred to io_uring_enter nothing consumes buffers
+// while the loop runs the handlers, and the kernel sees them in time for the
+// next submit. with -S the sqpoll thread issues recvs and consumes buffers at
+// any time, a recv it issues before the flush may find the group short and
+// fail with ENOBUFS, which grows the group or parks the connection as usual
+static void server_flush_bufs(server_t *s) {
+  for (uint32_t bgid = 0; bgid < BG_COUNT; ++bgid) {
+    buf_group_t *g = &s->groups[bgid];
+    if (!g->npending) {
+      continue;
+    }
+
+    uint16_t tail = g->br->tail;
+    int mask = io_uring_buf_ring_mask(g->max_entries);
+    for (uint32_t i = 0; i < g->npending; ++i) {
+      uint16_t bid = g->pending[i];
+      io_uring_buf_ring_add(g->br, server_get_selected_buffer(s, bgid, bid),
+                            g->buf_size, bid, mask, i);
+      g->bid_pos[bid] = tail + i;
+      if (cfg.inc_bufs) {
+        buf_meta_t *b = &s->buf_meta[g->meta_base + bid];
+        b->fill = 0;
+        b->refs = 1;
+      }
+    }
+    io_uring_buf_ring_advance(g->br, g->npending);
+    g->npending = 0;
+  }
+}
+
+// -i: slices live in buf_meta behind the buffers. the table doubles when it
+// runs out, no pointer into it may be held across an allocation
+static uint32_t server_slice_alloc(server_t *s) {
+  if (UNLIKELY(s->free_slices == BUF_NONE)) {
+    uint32_t n = s->nmeta;
+    s->buf_meta = realloc(s->buf_meta, 2 * (size_t)n * sizeof *s->buf_meta);
+    assert(s->buf_meta != NULL);
+    memset(&s->buf_meta[n], 0, n * sizeof *s->buf_meta);
+    for (uint32_t i = n; i < 2 * n; ++i) {
+      s->buf_meta[i].next = i + 1 < 2 * n ? i + 1 : BUF_NONE;
+    }
+    s->free_slices = n;
+    s->nmeta = 2 * n;
+  }
+
+  uint32_t ref = s->free_slices;
+  s->free_slices = s->buf_meta[ref].next;
+  return ref;
 }
 
 struct io_uring_sqe *must_get_sqe(server_t *s) {
   struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
   if (!sqe) {
+    STATS_INC(s->stats.early_submits);
     io_uring_submit(&s->ring);
     sqe = io_uring_get_sqe(&s->ring);
+    // with sqpoll the submit only hands the entries to the poller, wait for
+    // it to consume some of them. the wait also returns early on a pending
+    // signal, the submit re-wakes the poller should it have gone idle
+    while (!sqe && cfg.sqpoll) {
+      int ret = io_uring_sqring_wait(&s->ring);
+      if (ret < 0 && ret != -EINTR) {
+        break;
+      }
+      io_uring_submit(&s->ring);
+      sqe = io_uring_get_sqe(&s->ring);
+    }
     if (!sqe) {
       printf("failed to get an sqe shutting it down...\n");
       exit(1);
@@ -244,29 +1264,124 @@ struct io_uring_sqe *must_get_sqe(server_t *s) {
 
 static void server_add_multishot_accept(server_t *s, int listener_fd) {
   struct io_uring_sqe *accept_ms_sqe = must_get_sqe(s);
-  struct sockaddr_in client_addr;
 
-  socklen_t client_addr_len = sizeof(client_addr);
+  // the peer address is not used, and a multishot accept would keep writing
+  // it long after this stack frame is gone
   assert(accept_ms_sqe != NULL);
-  io_uring_prep_multishot_accept_direct(accept_ms_sqe, listener_fd,
-                                        (struct sockaddr *)&client_addr,
-                                        &client_addr_len, 0);
+  io_uring_prep_multishot_accept_direct(accept_ms_sqe, listener_fd, NULL, NULL,
+                                        0);
 
   uint64_t accept_ctx = 0;
   conn_set_event(&accept_ctx, EV_ACCEPT);
   io_uring_sqe_set_data64(accept_ms_sqe, accept_ctx);
 }
 
+// -A: passes the connection in the acceptor's slot fd to the worker with the
+// fewest live connections. the acceptor counts its passes itself and only
+// reads back what the workers closed, so a burst of accepts is spread out
+// before any worker got around to its cqes. ties go round robin
+// the close is hard linked and frees the slot whether or not the pass went
+// through, the msg ring only posts a cqe here when it failed
+static void server_pass_conn(server_t *s, uint32_t fd) {
+  uint32_t best = acceptor_next;
+  uint32_t best_load = UINT32_MAX;
+  for (int i = 0; i < cfg.threads; ++i) {
+    uint32_t w = (acceptor_next + i) % cfg.threads;
+    uint32_t load = acceptor_passed[w] -
+                    __atomic_load_n(&worker_links[w].closed, __ATOMIC_RELAXED);
+    if (load < best_load) {
+      best = w;
+      best_load = load;
+    }
+  }
+  acceptor_next = (best + 1) % cfg.threads;
+  acceptor_passed[best]++;
+  s->live_conns++;
+
+  // the worker's cqe carries the slot its table allocated in res
+  uint64_t data = 0;
+  conn_set_event(&data, EV_ACCEPT);
+  conn_set_buf_idx(&data, ACCEPT_PASSED);
+
+  struct io_uring_sqe *sqe = must_get_sqe(s);
+  io_uring_prep_msg_ring_fd(sqe, worker_links[best].ring_fd, fd,
+                            IORING_FILE_INDEX_ALLOC, data, 0);
+  io_uring_sqe_set_flags(sqe, IOSQE_IO_HARDLINK | IOSQE_CQE_SKIP_SUCCESS);
+  uint64_t ctx = 0;
+  conn_set_event(&ctx, EV_ACCEPT);
+  conn_set_fd(&ctx, fd);
+  conn_set_bgid(&ctx, best);
+  conn_set_buf_idx(&ctx, ACCEPT_PASS_FAILED);
+  io_uring_sqe_set_data64(sqe, ctx);
+
+  server_add_close_direct(s, fd);
+}
+
 static void server_add_recv(server_t *s, int fd) {
   struct io_uring_sqe *sqe = must_get_sqe(s);
-  io_uring_prep_recv(sqe, fd, NULL, 0, 0);
+  if (cfg.recv_multishot) {
+    io_uring_prep_recv_multishot(sqe, fd, NULL, 0, 0);
+  } else {
+    io_uring_prep_recv(sqe, fd, NULL, 0, 0);
+  }
+  uint32_t bgid = server_conn_get_bgid(s, fd);
+  if (UNLIKELY(s->conns[fd].parked)) {
+    conn_unpark(s, fd);
+  }
+  s->conns[fd].recv_armed = 1;
+  s->conns[fd].recv_bgid = bgid;
   io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT);
   uint64_t recv_ctx = 0;
   conn_set_event(&recv_ctx, EV_RECV);
   conn_set_fd(&recv_ctx, fd);
-  conn_set_bgid(&recv_ctx, server_conn_get_bgid(s));
+  conn_set_bgid(&recv_ctx, bgid);
   io_uring_sqe_set_data64(sqe, recv_ctx);
-  sqe->buf_group = server_conn_get_bgid(s);
+  sqe->buf_group = bgid;
+#ifdef HAVE_BUNDLES
+  if (cfg.bundles) {
+    // fill as many buffers as the socket has data for, in ring order
+    sqe->ioprio |= IORING_RECVSEND_BUNDLE;
+  }
+#endif
+}
+
+// splice mode: a splice on a socket is always punted to an io-wq worker,
+// which would sit blocked in it until data arrives. the poll in front makes
+// the splice in run only once the socket is readable, its cqe is skipped
+// unless it fails. should must_get_sqe submit in between, the splice still
+// runs, it just blocks in io-wq
+static void server_add_splice_in(server_t *s, uint32_t fd) {
+  uint64_t ctx = 0;
+  conn_set_event(&ctx, EV_SPLICE_IN);
+  conn_set_fd(&ctx, fd);
+
+  struct io_uring_sqe *sqe = must_get_sqe(s);
+  io_uring_prep_poll_add(sqe, fd, POLLIN);
+  io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | IOSQE_IO_LINK |
+                                  IOSQE_CQE_SKIP_SUCCESS);
+  uint64_t poll_ctx = ctx;
+  conn_set_buf_idx(&poll_ctx, SPLICE_POLL);
+  io_uring_sqe_set_data64(sqe, poll_ctx);
+
+  sqe = must_get_sqe(s);
+  io_uring_prep_splice(sqe, fd, -1, s->conn_pipes[fd][1], -1, PIPE_SIZE,
+                       SPLICE_F_MOVE | SPLICE_F_FD_IN_FIXED);
+  io_uring_sqe_set_data64(sqe, ctx);
+  s->conns[fd].recv_armed = 1;
+}
+
+// echoes len bytes out of the pipe, the pipe holds exactly what the last
+// splice in moved into it
+static void server_add_splice_out(server_t *s, uint32_t fd, uint32_t len) {
+  struct io_uring_sqe *sqe = must_get_sqe(s);
+  io_uring_prep_splice(sqe, s->conn_pipes[fd][0], -1, fd, -1, len,
+                       SPLICE_F_MOVE);
+  io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  uint64_t ctx = 0;
+  conn_set_event(&ctx, EV_SPLICE_OUT);
+  conn_set_fd(&ctx, fd);
+  io_uring_sqe_set_data64(sqe, ctx);
+  s->conns[fd].sending = 1;
 }
 
 static inline void server_add_send(server_t *s, uint64_t *ctx,
@@ -274,13 +1389,77 @@ static inline void server_add_send(server_t *s, uint64_t *ctx,
                                    uint32_t sqe_flags, uint32_t send_flags) {
   int fd = conn_get_fd(*ctx);
   struct io_uring_sqe *sqe = must_get_sqe(s);
-  io_uring_prep_send(sqe, fd, data, len, send_flags);
+  if (cfg.fixed_bufs) {
+    // there is no fixed buffer flavour of a plain send, a write to the
+    // socket is the same thing minus the send flags
+    uint32_t buf_index =
+        s->groups[conn_get_bgid(*ctx)].meta_base + conn_get_buf_idx(*ctx);
+    if (cfg.zc_threshold && len >= cfg.zc_threshold) {
+      io_uring_prep_send_zc_fixed(sqe, fd, data, len, send_flags,
+                                  IORING_SEND_ZC_REPORT_USAGE, buf_index);
+      conn_set_event(ctx, EV_SEND_ZC);
+    } else {
+      io_uring_prep_write_fixed(sqe, fd, data, len, 0, buf_index);
+      conn_set_event(ctx, EV_SEND);
+    }
+  } else if (cfg.zc_threshold && len >= cfg.zc_threshold) {
+    io_uring_prep_send_zc(sqe, fd, data, len, send_flags,
+                          IORING_SEND_ZC_REPORT_USAGE);
+    conn_set_event(ctx, EV_SEND_ZC);
+  } else {
+    io_uring_prep_send(sqe, fd, data, len, send_flags);
+    conn_set_event(ctx, EV_SEND);
+  }
   io_uring_sqe_set_flags(sqe, sqe_flags);
-
-  conn_set_event(ctx, EV_SEND);
   io_uring_sqe_set_data64(sqe, *ctx);
 }
 
+// cancels the outstanding recv of fd, it completes with -ECANCELED
+static void server_add_cancel_recv(server_t *s, uint32_t fd) {
+  uint64_t recv_ctx = 0;
+  conn_set_event(&recv_ctx, EV_RECV);
+  conn_set_fd(&recv_ctx, fd);
+  conn_set_bgid(&recv_ctx, s->conns[fd].recv_bgid);
+
+  struct io_uring_sqe *sqe = must_get_sqe(s);
+  io_uring_prep_cancel64(sqe, recv_ctx, 0);
+  io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
+
+  uint64_t cancel_ctx = 0;
+  conn_set_event(&cancel_ctx, EV_CANCEL);
+  conn_set_fd(&cancel_ctx, fd);
+  io_uring_sqe_set_data64(sqe, cancel_ctx);
+}
+
+// shuts both directions of fd down, whatever is in flight on it ends the
+// way it would if the peer went away: a recv or a splice poll sees the end
+// of the stream, a send that waits for room fails with -EPIPE
+static void server_add_shutdown(server_t *s, uint32_t fd) {
+  struct io_uring_sqe *sqe = must_get_sqe(s);
+  io_uring_prep_shutdown(sqe, fd, SHUT_RDWR);
+  io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | IOSQE_CQE_SKIP_SUCCESS);
+
+  uint64_t cancel_ctx = 0;
+  conn_set_event(&cancel_ctx, EV_CANCEL);
+  conn_set_fd(&cancel_ctx, fd);
+  io_uring_sqe_set_data64(sqe, cancel_ctx);
+}
+
+#ifdef HAVE_TIMEOUT_MULTISHOT
+// -T: one multishot timeout posts a cqe every tick for as long as the worker
+// runs, each one advances the idle timer wheel
+static void server_add_tick_timeout(server_t *s) {
+  s->tick_ts.tv_sec = IDLE_TICK_MS / 1000;
+  s->tick_ts.tv_nsec = (IDLE_TICK_MS % 1000) * 1000000LL;
+
+  struct io_uring_sqe *sqe = must_get_sqe(s);
+  io_uring_prep_timeout(sqe, &s->tick_ts, 0, IORING_TIMEOUT_MULTISHOT);
+  uint64_t ctx = 0;
+  conn_set_event(&ctx, EV_TIMEOUT);
+  io_uring_sqe_set_data64(sqe, ctx);
+}
+#endif
+
 static void server_add_close_direct(server_t *s, uint32_t fd) {
   struct io_uring_sqe *sqe = must_get_sqe(s);
   sqe->fd = fd;
@@ -294,62 +1473,585 @@ static void server_add_close_direct(server_t *s, uint32_t fd) {
   io_uring_sqe_set_data64(sqe, close_ctx);
 }
 
+static inline void conn_sendq_push(server_t *s, uint32_t fd, uint32_t ref,
+                                   uint32_t len) {
+  conn_t *c = &s->conns[fd];
+  s->buf_meta[ref].len = len;
+  s->buf_meta[ref].off = 0;
+  s->buf_meta[ref].next = BUF_NONE;
+  s->buf_meta[ref].released = 0;
+  if (c->sendq_head == BUF_NONE) {
+    c->sendq_head = ref;
+  } else {
+    s->buf_meta[c->sendq_tail].next = ref;
+  }
+  c->sendq_tail = ref;
+  c->queued += len;
+}
+
+// moves the connection up a group as soon as a recv fills a whole buffer (or
+// a bundle of them) and
+// down a group after a run of recvs that would have fit the smaller buffers,
+// returns 1 if the connection's group changed
+static inline int conn_update_bgid(server_t *s, uint32_t fd, uint32_t bgid,
+                                   uint32_t len) {
+  conn_t *c = &s->conns[fd];
+  uint32_t next = c->bgid;
+  if (len >= s->groups[bgid].buf_size) {
+    c->small_recvs = 0;
+    if (bgid + 1 < BG_COUNT) {
+      next = bgid + 1;
+    }
+  } else if (bgid > 0 && len <= s->groups[bgid - 1].buf_size) {
+    if (++c->small_recvs == BG_SHRINK_AFTER) {
+      c->small_recvs = 0;
+      next = bgid - 1;
+    }
+  } else {
+    c->small_recvs = 0;
+  }
+
+  if (next == c->bgid) {
+    return 0;
+  }
+  c->bgid = next;
+  return 1;
+}
+
+static inline void conn_send_next(server_t *s, uint32_t fd) {
+  conn_t *c = &s->conns[fd];
+  if (c->sending || c->sendq_head == BUF_NONE) {
+    return;
+  }
+
+  if (cfg.bundles) {
+    conn_send_bundle(s, fd);
+    return;
+  }
+
+  buf_meta_t *m = &s->buf_meta[c->sendq_head];
+  uint64_t ctx = 0;
+  conn_set_fd(&ctx, fd);
+  conn_set_bgid(&ctx, m->bgid);
+  conn_set_buf_idx(&ctx, m->bid);
+  c->sending = 1;
+  server_add_send(s, &ctx,
+                  server_get_selected_buffer(s, m->bgid, m->bid) + m->base +
+                      m->off,
+                  m->len - m->off, IOSQE_FIXED_FILE, 0);
+}
+
+// bundle mode: echoes the head of the send queue and up to BUNDLE_MAX_IOVS - 1
+// buffers behind it with one sendmsg, on_write walks the queue by the bytes
+// it moved
+static void conn_send_bundle(server_t *s, uint32_t fd) {
+  conn_t *c = &s->conns[fd];
+  struct io_uring_sqe *sqe = must_get_sqe(s);
+  send_msg_t *sm = &s->send_msgs[sqe - s->ring.sq.sqes];
+  uint32_t n = 0;
+  for (uint32_t ref = c->sendq_head; ref != BUF_NONE && n < BUNDLE_MAX_IOVS;
+       ref = s->buf_meta[ref].next) {
+    buf_meta_t *m = &s->buf_meta[ref];
+    sm->iov[n].iov_base =
+        server_get_selected_buffer(s, m->bgid, m->bid) + m->base + m->off;
+    sm->iov[n].iov_len = m->len - m->off;
+    ++n;
+  }
+  memset(&sm->msg, 0, sizeof sm->msg);
+  sm->msg.msg_iov = sm->iov;
+  sm->msg.msg_iovlen = n;
+  STATS_ADD(s->stats.gathered_sends, n > 1);
+
+  io_uring_prep_sendmsg(sqe, fd, &sm->msg, 0);
+  io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  uint64_t ctx = 0;
+  conn_set_event(&ctx, EV_SEND);
+  conn_set_fd(&ctx, fd);
+  io_uring_sqe_set_data64(sqe, ctx);
+  c->sending = 1;
+}
+
+// stops receiving on fd until its send queue drained, a one-shot recv is
+// simply not re-armed while a multishot recv has to be cancelled
+static inline void conn_pause_recv(server_t *s, uint32_t fd) {
+  conn_t *c = &s->conns[fd];
+  c->paused = 1;
+  if (cfg.recv_multishot && c->recv_armed) {
+    server_add_cancel_recv(s, fd);
+  }
+}
+
+static void conn_park(server_t *s, uint32_t fd, uint32_t bgid) {
+  conn_t *c = &s->conns[fd];
+  buf_group_t *g = &s->groups[bgid];
+  if (c->parked) {
+    return;
+  }
+
+  c->parked = 1;
+  c->wait_next = CONN_NONE;
+  c->wait_prev = g->wait_tail;
+  c->recv_bgid = bgid;
+  if (g->wait_tail == CONN_NONE) {
+    g->wait_head = fd;
+  } else {
+    s->conns[g->wait_tail].wait_next = fd;
+  }
+  g->wait_tail = fd;
+  s->bp.parked++;
+}
+
+static void conn_unpark(server_t *s, uint32_t fd) {
+  conn_t *c = &s->conns[fd];
+  buf_group_t *g = &s->groups[c->recv_bgid];
+  if (c->wait_prev == CONN_NONE) {
+    g->wait_head = c->wait_next;
+  } else {
+    s->conns[c->wait_prev].wait_next = c->wait_next;
+  }
+
+  if (c->wait_next == CONN_NONE) {
+    g->wait_tail = c->wait_prev;
+  } else {
+    s->conns[c->wait_next].wait_prev = c->wait_prev;
+  }
+  c->parked = 0;
+}
+
+// the direct descriptor may only be closed once no recv or send is in flight,
+// otherwise a late completion would land on the slot's next owner
+static void conn_maybe_close(server_t *s, uint32_t fd) {
+  conn_t *c = &s->conns[fd];
+  if (!c->closing || c->sending || c->recv_armed) {
+    return;
+  }
+
+  if (c->parked) {
+    conn_unpark(s, fd);
+  }
+
+  while (c->sendq_head != BUF_NONE) {
+    buf_meta_t *m = &s->buf_meta[c->sendq_head];
+    c->sendq_head = m->next;
+    server_release_buff(s, m);
+  }
+
+  if (cfg.splice) {
+    // a pipe with bytes still in it is closed rather than reused
+    pipe_pool_put(&s->pipes, s->conn_pipes[fd], c->queued == 0);
+  }
+  tw_cancel(&s->wheel, &c->idle);
+  server_add_close_direct(s, fd);
+}
+
 static void on_accept(server_t *s, uint64_t ctx,
                       struct io_uring_cqe *cqe) {
+  uint32_t kind = conn_get_buf_idx(ctx);
+  if (UNLIKELY(kind == ACCEPT_PASS_FAILED)) {
+    // the worker's table is full or its ring is gone, the linked close
+    // drops the connection
+    uint32_t w = conn_get_bgid(ctx);
+    acceptor_passed[w]--;
+    fprintf(stderr, "passing a connection to worker %u: %s\n", w,
+            strerror(-cqe->res));
+    return;
+  }
+
+  // the multishot accept stops on errors and cq overflows, put it back. a
+  // connection passed in by the acceptor has no accept behind it
+  if (UNLIKELY(kind != ACCEPT_PASSED && !(cqe->flags & IORING_CQE_F_MORE))) {
+    server_add_multishot_accept(s, s->listen_fd);
+  }
+
   if (UNLIKELY(cqe->res < 0)) {
-    printf("accept error: %d exiting...\n", cqe->res);
-    exit(1);
+    // -ENFILE: every direct descriptor slot is taken, the kernel dropped the
+    // connection and slots free up again as connections close
+    if (cqe->res != -ENFILE && cqe->res != -ECONNABORTED &&
+        cqe->res != -EMFILE && cqe->res != -ENOBUFS && cqe->res != -ENOMEM) {
+      printf("accept error: %d exiting...\n", cqe->res);
+      exit(1);
+    }
+    fprintf(stderr, "accept: %s (%u live connections)\n",
+            strerror(-cqe->res), s->live_conns);
+    return;
+  }
+
+  if (s->acceptor) {
+    server_pass_conn(s, cqe->res);
+    return;
+  }
+
+  s->live_conns++;
+  conn_t *c = &s->conns[cqe->res];
+  memset(c, 0, sizeof *c);
+  c->sendq_head = c->sendq_tail = BUF_NONE;
+  c->bgid = cfg.inc_bufs ? BG_INC : BG_INITIAL;
+  if (cfg.idle_ticks) {
+    c->idle.owner = cqe->res;
+    c->last_active = s->wheel.now;
+    tw_arm(&s->wheel, &c->idle, s->wheel.now + cfg.idle_ticks);
+  }
+  if (cfg.splice) {
+    if (pipe_pool_get(&s->pipes, s->conn_pipes[cqe->res]) != 0) {
+      perror("pipe2");
+      tw_cancel(&s->wheel, &c->idle);
+      server_add_close_direct(s, cqe->res);
+      return;
+    }
+    server_add_splice_in(s, cqe->res);
+    return;
   }
   server_add_recv(s, cqe->res);
 }
 
 static void on_read(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe) {
+  uint32_t fd = conn_get_fd(ctx);
+  conn_t *c = &s->conns[fd];
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    c->recv_armed = 0; // one-shot recv done or multishot recv terminated
+  }
+
   if (UNLIKELY(cqe->res <= 0)) {
     if (cqe->res == -ENOBUFS) {
-      fprintf(stderr, "ran out of buffers exiting program...\n");
-      exit(-ENOBUFS);
+      server_on_enobufs(s, fd, conn_get_bgid(ctx));
+    } else if (cqe->res == -ECANCELED && !c->closing) {
+      // cancelled to pause receiving or to switch buffer groups, the queue
+      // may have drained meanwhile
+      if (!c->paused) {
+        server_add_recv(s, fd);
+      }
     } else {
-      server_add_close_direct(s, conn_get_fd(ctx));
+      c->closing = 1;
+      conn_maybe_close(s, fd);
     }
+    return;
+  }
+
+  c->last_active = s->wheel.now;
+  uint32_t bgid = conn_get_bgid(ctx);
+  unsigned int buf_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+  // printf("buffer-group: %d\tbuffer-id: %d\n", bgid, buf_id);
+  if (cfg.inc_bufs) {
+    conn_recv_slice(s, fd, bgid, buf_id, cqe);
   } else {
-    unsigned int buf_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
-    // printf("buffer-group: %d\tbuffer-id: %d\n", bgid, buf_id);
-    unsigned char *buf = server_get_selected_buffer(s, buf_id);
-    // printf("%s\n", recv_buf);
-    conn_set_buf_idx(&ctx, buf_id);
-    server_add_send(s, &ctx, buf, cqe->res, IOSQE_FIXED_FILE, 0);
+    conn_recv_bufs(s, fd, bgid, buf_id, cqe->res);
+  }
+
+  if (UNLIKELY(c->closing)) {
+    conn_maybe_close(s, fd);
+    return;
+  }
+  conn_send_next(s, fd);
+
+  // a one-shot recv picks the new group up when it is re-armed, a multishot
+  // recv is bound to its group and is restarted through a cancel. shared
+  // buffers make the smaller groups pointless, -i stays in BG_INC
+  if (!cfg.inc_bufs && conn_update_bgid(s, fd, bgid, cqe->res) &&
+      cfg.recv_multishot && c->recv_armed && !c->paused) {
+    server_add_cancel_recv(s, fd);
+  }
+
+  if (c->queued >= cfg.high_watermark) {
+    if (!c->paused) {
+      conn_pause_recv(s, fd);
+    }
+  } else if (!c->recv_armed) {
+    // keep a read posted while earlier sends drain, this also replaces a
+    // multishot recv that stopped on its own (e.g. when the cq overflows)
+    server_add_recv(s, fd);
+  }
+}
+
+// queues the len bytes a recv put into buffer bid. a bundle fills bid and the
+// buffers that followed it in the ring, the ring still holds their ids as
+// nothing is flushed to it before the loop ran every handler
+static void conn_recv_bufs(server_t *s, uint32_t fd, uint32_t bgid,
+                           uint32_t bid, uint32_t len) {
+  buf_group_t *g = &s->groups[bgid];
+  uint32_t nbufs = (len + g->buf_size - 1) / g->buf_size;
+  uint16_t pos = g->bid_pos[bid];
+  int mask = io_uring_buf_ring_mask(g->max_entries);
+  STATS_ADD(s->stats.bundled_recvs, nbufs > 1);
+  STATS_ADD(s->stats.short_reads, len < nbufs * g->buf_size);
+  for (uint32_t i = 0; i < nbufs; ++i) {
+    uint32_t id = i ? g->br->bufs[(uint16_t)(pos + i) & mask].bid : bid;
+    uint32_t n = len < g->buf_size ? len : g->buf_size;
+    len -= n;
+    if (UNLIKELY(s->conns[fd].closing)) {
+      // data still arriving on a connection whose send side already failed
+      server_recycle_buff(s, bgid, id);
+    } else {
+      conn_sendq_push(s, fd, g->meta_base + id, n);
+    }
+  }
+}
+
+// -i: the kernel fills a buffer recv by recv, each recv's bytes start where
+// the previous recv into the same buffer stopped. they are queued as a slice
+// holding a reference on the buffer, the kernel's own reference goes with
+// the first completion that comes without IORING_CQE_F_BUF_MORE
+static void conn_recv_slice(server_t *s, uint32_t fd, uint32_t bgid,
+                            uint32_t bid, struct io_uring_cqe *cqe) {
+  uint32_t ref = s->conns[fd].closing ? BUF_NONE : server_slice_alloc(s);
+  buf_meta_t *b = &s->buf_meta[s->groups[bgid].meta_base + bid];
+  if (ref != BUF_NONE) {
+    buf_meta_t *m = &s->buf_meta[ref];
+    m->bgid = bgid;
+    m->bid = bid;
+    m->base = b->fill;
+    b->refs++;
+    conn_sendq_push(s, fd, ref, cqe->res);
+  }
+  b->fill += cqe->res;
+
+  int more = 0;
+#ifdef HAVE_PBUF_INC
+  more = cqe->flags & IORING_CQE_F_BUF_MORE;
+#endif
+  if (!more && --b->refs == 0) {
+    server_recycle_buff(s, bgid, bid);
   }
 }
 
 static void on_write(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe) {
-  uint32_t buf_idx = conn_get_buf_idx(ctx);
-  //   printf("buffer-group: %d\tbuffer-id: %d\n", bgid, buf_idx);
-  unsigned char *buf = server_get_selected_buffer(s, buf_idx);
+  uint32_t fd = conn_get_fd(ctx);
+  conn_t *c = &s->conns[fd];
+
+  c->sending = 0;
   if (UNLIKELY(cqe->res <= 0)) {
-    fprintf(stderr, "send(): %s\n", strerror(-cqe->res));
-    server_add_close_direct(s, conn_get_fd(ctx));
-  } else {
-    server_add_recv(s, conn_get_fd(ctx));
+    if (!c->closing) {
+      fprintf(stderr, "send(): %s\n", strerror(-cqe->res));
+    }
+    c->closing = 1;
+    if (c->recv_armed) {
+      server_add_cancel_recv(s, fd);
+    }
+    conn_maybe_close(s, fd);
+    return;
   }
 
-  server_recycle_buff(s, buf, buf_idx);
+  // the send started at the head of the queue, a gathered one may have
+  // covered several buffers
+  c->last_active = s->wheel.now;
+  uint32_t left = cqe->res;
+  c->queued -= left;
+  while (left) {
+    buf_meta_t *m = &s->buf_meta[c->sendq_head];
+    uint32_t n = left < m->len - m->off ? left : m->len - m->off;
+    m->off += n;
+    left -= n;
+    if (m->off == m->len) {
+      c->sendq_head = m->next;
+      server_release_buff(s, m);
+    } else {
+      STATS_INC(s->stats.short_writes);
+    }
+  }
+
+  if (UNLIKELY(c->closing)) {
+    conn_maybe_close(s, fd);
+    return;
+  }
+
+  // sends the remainder after a short send or the next queued buffer
+  conn_send_next(s, fd);
+
+  if (c->paused && c->queued < cfg.high_watermark / 2) {
+    c->paused = 0;
+    if (!c->recv_armed) {
+      server_add_recv(s, fd);
+    }
+  }
+}
+
+// a zero-copy send completes twice: first with the send result like any other
+// send (F_MORE set if a notification follows), then with F_NOTIF once the
+// network stack let go of the buffer. the notification only touches the
+// buffer, the connection may be long gone by then
+static void on_write_zc(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe) {
+  uint32_t bgid = conn_get_bgid(ctx);
+  buf_meta_t *m =
+      &s->buf_meta[s->groups[bgid].meta_base + conn_get_buf_idx(ctx)];
+
+  if (!(cqe->flags & IORING_CQE_F_NOTIF)) {
+    if (cqe->flags & IORING_CQE_F_MORE) {
+      m->zc_notifs++;
+    }
+    on_write(s, ctx, cqe);
+    return;
+  }
+
+  // e.g. loopback, the data was copied after all
+  if (UNLIKELY(cqe->res & IORING_NOTIF_USAGE_ZC_COPIED)) {
+    uint64_t n = ++s->zc_copied;
+    if (!(n & (n - 1))) {
+      fprintf(stderr, "zero-copy sends copied by the kernel: %lu\n", n);
+    }
+  }
+
+  if (--m->zc_notifs == 0 && m->released) {
+    m->released = 0;
+    server_recycle_buff(s, m->bgid, m->bid);
+  }
 }
 
+// the kernel hands the slot to the next accept as soon as the close ran
 static void on_close(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe) {
+  s->live_conns--;
+  if (s->link) {
+    __atomic_fetch_add(&s->link->closed, 1, __ATOMIC_RELAXED);
+  }
   if (cqe->res < 0) {
     fprintf(stderr, "close: %s\n", strerror(-cqe->res));
   }
 }
 
+static void on_cancel(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe) {
+  // the recv may have completed before the cancel got to it, a shutdown may
+  // find the peer gone already
+  if (cqe->res < 0 && cqe->res != -ENOENT && cqe->res != -EALREADY &&
+      cqe->res != -ENOTCONN) {
+    fprintf(stderr, "cancel: %s\n", strerror(-cqe->res));
+  }
+}
+
+// splice mode keeps one request outstanding per connection, a poll and splice
+// in pair while waiting for input and a splice out while echoing. queued
+// counts the bytes sitting in the pipe
+static void on_splice_in(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe) {
+  uint32_t fd = conn_get_fd(ctx);
+  conn_t *c = &s->conns[fd];
+  if (conn_get_buf_idx(ctx) == SPLICE_POLL) {
+    // the poll failed, the linked splice completes with -ECANCELED next
+    c->closing = 1;
+    return;
+  }
+
+  c->recv_armed = 0;
+  if (UNLIKELY(cqe->res <= 0)) {
+    c->closing = 1;
+    conn_maybe_close(s, fd);
+    return;
+  }
+
+  STATS_ADD(s->stats.short_reads, cqe->res < PIPE_SIZE);
+  c->last_active = s->wheel.now;
+  c->queued = cqe->res;
+  server_add_splice_out(s, fd, c->queued);
+}
+
+static void on_splice_out(server_t *s, uint64_t ctx,
+                          struct io_uring_cqe *cqe) {
+  uint32_t fd = conn_get_fd(ctx);
+  conn_t *c = &s->conns[fd];
+  c->sending = 0;
+  if (UNLIKELY(cqe->res <= 0)) {
+    c->closing = 1;
+    conn_maybe_close(s, fd);
+    return;
+  }
+
+  c->last_active = s->wheel.now;
+  c->queued -= cqe->res;
+  if (c->queued > 0) {
+    STATS_INC(s->stats.short_writes);
+    server_add_splice_out(s, fd, c->queued);
+  } else {
+    server_add_splice_in(s, fd);
+  }
+}
+
+static void on_timeout(server_t *s, uint64_t ctx, struct io_uring_cqe *cqe) {
+  // every tick completes with -ETIME, anything else means the kernel
+  // rejected the timeout (multishot timeouts need linux 6.4)
+  if (UNLIKELY(cqe->res != -ETIME)) {
+    fprintf(stderr, "idle timeout tick: %s\n", strerror(-cqe->res));
+    exit(EXIT_FAILURE);
+  }
+#ifdef HAVE_TIMEOUT_MULTISHOT
+  // like the multishot accept, the timeout stops on cq overflows
+  if (UNLIKELY(!(cqe->flags & IORING_CQE_F_MORE))) {
+    server_add_tick_timeout(s);
+  }
+#endif
+  tw_advance(&s->wheel, idle_now(), conn_on_idle, s);
+}
+
+// recvs and sends only note the tick they moved data at, the timer armed at
+// accept is pushed out when it fires on a connection that was busy since.
+// an idle one is shut down, the completions of what it still has in flight
+// take it through the usual close
+static void conn_on_idle(void *arg, tw_timer_t *t) {
+  server_t *s = arg;
+  uint32_t fd = t->owner;
+  conn_t *c = &s->conns[fd];
+  uint32_t idle = (uint32_t)s->wheel.now - c->last_active;
+  if (idle < cfg.idle_ticks) {
+    tw_arm(&s->wheel, t, s->wheel.now + cfg.idle_ticks - idle);
+    return;
+  }
+
+  s->idle_closed++;
+  c->closing = 1;
+  if (c->recv_armed || c->sending) {
+    server_add_shutdown(s, fd);
+  }
+  conn_maybe_close(s, fd);
+}
+
+static inline uint64_t idle_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / IDLE_TICK_MS;
+}
+
+#ifdef SERVER_STATS
+// formats the whole snapshot first so that dumps of different workers don't
+// interleave line by line
+static void server_stats_dump(server_t *s) {
+  static const char *ev_names[EV_COUNT] = {
+      "accept", "recv", "send", "close", "cancel", "send_zc", "splice_in",
+      "splice_out", "timeout"};
+  server_stats_t *st = &s->stats;
+  char *out = NULL;
+  size_t len = 0;
+  FILE *f = open_memstream(&out, &len);
+  if (!f) {
+    return;
+  }
+
+  fprintf(f, "[stats worker %d] live=%u recycled=%lu short_reads=%lu "
+             "short_writes=%lu early_submits=%lu cq_overflows=%lu "
+             "sq_wakeups=%lu bundled_recvs=%lu gathered_sends=%lu "
+             "idle_closed=%lu\n",
+          st->id, s->live_conns, st->recycled, st->short_reads,
+          st->short_writes, st->early_submits, s->cq_overflows,
+          st->sq_wakeups, st->bundled_recvs, st->gathered_sends,
+          s->idle_closed);
+  fprintf(f, "  buffers: enobufs=%lu grown=%lu parked=%lu woken=%lu\n",
+          s->bp.enobufs, s->bp.grown, s->bp.parked, s->bp.woken);
+  stats_hist_print(f, "cqes/wait", &st->cqes_per_wait);
+  for (int ev = 0; ev < EV_COUNT; ++ev) {
+    char name[32];
+    if (st->handler_ns[ev].count) {
+      snprintf(name, sizeof name, "%s ns", ev_names[ev]);
+      stats_hist_print(f, name, &st->handler_ns[ev]);
+    }
+  }
+  fclose(f);
+  fwrite(out, 1, len, stderr);
+  free(out);
+}
+#endif
 
 #define FD_MASK ((1ULL << 21) - 1)
 #define BGID_SHIFT 21
 #define BGID_MASK (((1ULL << 15) - 1) << BGID_SHIFT)
 
 #define EVENT_SHIFT 36
-#define EVENT_MASK (3ULL << EVENT_SHIFT)
+#define EVENT_MASK (15ULL << EVENT_SHIFT)
 
-#define BUFIDX_SHIFT 39
+#define BUFIDX_SHIFT 40
 #define BUFIDX_MASK (((1ULL << 16) - 1) << BUFIDX_SHIFT)
 
 
@@ -0,0 +1,481 @@
+#!/usr/bin/env python3
+"""Results database for the reports under bench/.
+
+Every report lives at bench/<mode>/<payload>/<conns>-conn/<name>.txt, where
+<name> is an engine name (epoll, io_uring), optionally followed by a variant
+suffix (io_uring-multishot, io_uring-4t) and a repetition number (epoll.2).
+Repetitions of the same scenario are averaged. A <name>.perf.csv next to a
+report holds the server's perf stat counters for that run, as written by
+tools/run_bench.py.
+
+    benchdb.py export  [--root bench] [--format csv|json] [--out FILE]
+    benchdb.py compare [--root bench] --base epoll --target io_uring
+    benchdb.py diff    OLD_ROOT NEW_ROOT [--threshold 5] [--only-regressions]
+    benchdb.py charts  [--root bench] [--out DIR]
+
+compare and diff exit with status 1 when a scenario regressed by more than
+--threshold percent, so they can gate a change in a script.
+"""
+
+import argparse
+import csv
+import json
+import math
+import os
+import re
+import signal
+import sys
+
+BYTE_UNITS = {"B": 1, "kB": 1e3, "MB": 1e6, "GB": 1e9, "TB": 1e12, "PB": 1e15}
+DURATION_UNITS = {"ns": 1, "µs": 1e3, "us": 1e3, "ms": 1e6, "s": 1e9,
+                  "m": 60e9, "h": 3600e9}
+
+HEADER_RE = re.compile(
+    r"address: (?P<address>\S+)\tmode: (?P<mode>\S+)\tpayload: (?P<payload>[^\t]+)"
+    r"\tduration: (?P<duration>\S+)\tconnections: (?P<connections>\d+)")
+CONN_RE = re.compile(r"^\[Conn \d+\].* res/sec (?P<res>\d+)")
+TOTAL_RE = re.compile(r"^(?P<key>[a-z0-9.\-/]+):\s+(?P<value>.+?)\s*$")
+NAME_RE = re.compile(r"^(?P<engine>.+?)(?:\.(?P<rep>\d+))?$")
+
+# report line -> (column, parser)
+TOTALS = {
+    "total-sent/second": ("sent_per_sec", "bytes"),
+    "total-received/second": ("received_per_sec", "bytes"),
+    "total-requests/second": ("requests_per_sec", "int"),
+    "total-responses/second": ("responses_per_sec", "int"),
+    "total-bytes-sent": ("bytes_sent", "bytes"),
+    "total-bytes-received": ("bytes_received", "bytes"),
+    "total-requests-sent": ("requests", "int"),
+    "total-responses-received": ("responses", "int"),
+    "avg-response-time": ("avg_response_ns", "duration"),
+    "p50-response-time": ("p50_response_ns", "duration"),
+    "p99-response-time": ("p99_response_ns", "duration"),
+    "p99.9-response-time": ("p999_response_ns", "duration"),
+    "max-response-time": ("max_response_ns", "duration"),
+    "server-cpu-time": ("server_cpu_ns", "duration"),
+}
+
+# perf stat event -> column, counts are per run
+PERF_EVENTS = {
+    "cycles": "cycles",
+    "instructions": "instructions",
+    "context-switches": "context_switches",
+    "cache-misses": "cache_misses",
+    "dTLB-load-misses": "dtlb_load_misses",
+    "dTLB-store-misses": "dtlb_store_misses",
+    "raw_syscalls:sys_enter": "syscalls",
+}
+
+# metric -> True if a larger value is better
+METRICS = {
+    "sent_per_sec": True,
+    "received_per_sec": True,
+    "requests_per_sec": True,
+    "responses_per_sec": True,
+    "avg_response_ns": False,
+    "p50_response_ns": False,
+    "p99_response_ns": False,
+    "p999_response_ns": False,
+    "max_response_ns": False,
+    # share of one core the server used during the run
+    "server_cpu_pct": False,
+    # server cpu time per GB echoed back to the client
+    "server_cpu_ms_per_gb": False,
+    # perf counters divided by the responses of the run
+    "cycles_per_response": False,
+    "instructions_per_response": False,
+    "context_switches_per_response": False,
+    "cache_misses_per_response": False,
+    "dtlb_load_misses_per_response": False,
+    "dtlb_store_misses_per_response": False,
+    "syscalls_per_response": False,
+}
+
+# compared unless --metric says otherwise, the other throughput metrics move
+# in lockstep with responses_per_sec
+DEFAULT_METRICS = ["responses_per_sec", "avg_response_ns", "p99_response_ns",
+                   "p999_response_ns"]
+
+KEY_COLUMNS = ["mode", "payload", "connections", "engine"]
+COLUMNS = KEY_COLUMNS + ["rep", "duration_s", "path"] + \
+    [col for col, _ in TOTALS.values()] + \
+    ["server_cpu_pct", "server_cpu_ms_per_gb", "conn_res_min",
+     "conn_res_max"] + \
+    list(PERF_EVENTS.values()) + \
+    [m for m in METRICS if m.endswith("_per_response")]
+
+
+def parse_bytes(s):
+    value, unit = s.split()
+    return float(value) * BYTE_UNITS[unit]
+
+
+def parse_duration(s):
+    """Parses go formatted durations such as 20.274µs or 3m0s into ns."""
+    total = 0.0
+    for value, unit in re.findall(r"([0-9.]+)(ns|µs|us|ms|s|m|h)", s):
+        total += float(value) * DURATION_UNITS[unit]
+    return total
+
+
+PARSERS = {"bytes": parse_bytes, "int": int, "duration": parse_duration}
+
+
+def parse_report(path):
+    row = {"path": path}
+    conn_res = []
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            m = HEADER_RE.search(line)
+            if m:
+                row["duration_s"] = parse_duration(m["duration"]) / 1e9
+                row["connections"] = int(m["connections"])
+                row["mode"] = m["mode"]
+                continue
+            m = CONN_RE.match(line)
+            if m:
+                conn_res.append(int(m["res"]))
+                continue
+            m = TOTAL_RE.match(line)
+            if m and m["key"] in TOTALS:
+                col, kind = TOTALS[m["key"]]
+                row[col] = PARSERS[kind](m["value"])
+    if "mode" not in row:
+        return None
+    if "server_cpu_ns" in row and row.get("duration_s"):
+        row["server_cpu_pct"] = row["server_cpu_ns"] / 1e7 / row["duration_s"]
+    if "server_cpu_ns" in row and row.get("bytes_received"):
+        row["server_cpu_ms_per_gb"] = \
+            row["server_cpu_ns"] / 1e6 / (row["bytes_received"] / 1e9)
+    if conn_res:
+        row["conn_res_min"] = min(conn_res)
+        row["conn_res_max"] = max(conn_res)
+    return row
+
+
+def parse_perf(path, row):
+    """Adds the counters of a perf stat -x, file to row. Counters perf could
+    not read are left out."""
+    with open(path, encoding="utf-8") as f:
+        for rec in csv.reader(f):
+            if len(rec) < 3 or rec[0].startswith("#"):
+                continue
+            # modifiers such as cycles:u are dropped
+            event = rec[2] if rec[2] in PERF_EVENTS else rec[2].rsplit(":", 1)[0]
+            if event not in PERF_EVENTS:
+                continue
+            try:
+                row[PERF_EVENTS[event]] = float(rec[0])
+            except ValueError:
+                continue
+    if row.get("responses"):
+        for col in PERF_EVENTS.values():
+            if col in row:
+                row[col + "_per_response"] = row[col] / row["responses"]
+
+
+def load(root):
+    """Returns one row per report found under root."""
+    rows = []
+    for dirpath, _, files in os.walk(root):
+        for name in sorted(files):
+            if not name.endswith(".txt"):
+                continue
+            path = os.path.join(dirpath, name)
+            row = parse_report(path)
+            if row is None:
+                print(f"skipping {path}: not a report", file=sys.stderr)
+                continue
+            perf = path[:-len(".txt")] + ".perf.csv"
+            if os.path.exists(perf):
+                parse_perf(perf, row)
+            m = NAME_RE.match(name[:-len(".txt")])
+            row["engine"] = m["engine"]
+            row["rep"] = int(m["rep"] or 1)
+            # the payload dir holds the exact byte count, the header rounds
+            row["payload"] = int(os.path.basename(os.path.dirname(dirpath)))
+            rows.append({c: row[c] for c in COLUMNS if c in row})
+    rows.sort(key=lambda r: (r["mode"], r["payload"], r["connections"],
+                             r["engine"], r["rep"]))
+    return rows
+
+
+def aggregate(rows):
+    """Averages the repetitions of each scenario, keyed by KEY_COLUMNS."""
+    groups = {}
+    for row in rows:
+        groups.setdefault(tuple(row[k] for k in KEY_COLUMNS), []).append(row)
+
+    out = {}
+    for key, reps in groups.items():
+        agg = {"reps": len(reps)}
+        for metric in METRICS:
+            values = [r[metric] for r in reps if metric in r]
+            if not values:
+                continue
+            mean = sum(values) / len(values)
+            agg[metric] = mean
+            if len(values) > 1:
+                var = sum((v - mean) ** 2 for v in values) / (len(values) - 1)
+                agg[metric + "_stdev"] = math.sqrt(var)
+        out[key] = agg
+    return out
+
+
+def delta_pct(base, new):
+    if not base:
+        return None
+    return (new - base) / base * 100.0
+
+
+def is_regression(metric, delta, threshold):
+    if delta is None:
+        return False
+    return -delta > threshold if METRICS[metric] else delta > threshold
+
+
+def fmt_value(metric, v):
+    if v is None:
+        return "-"
+    if metric.endswith("_ns"):
+        return f"{v / 1e6:.2f}ms" if v >= 1e6 else f"{v / 1e3:.1f}µs"
+    if metric in ("sent_per_sec", "received_per_sec"):
+        return f"{v / 1e6:.1f}MB"
+    if metric == "server_cpu_pct":
+        return f"{v:.1f}%"
+    if metric == "server_cpu_ms_per_gb":
+        return f"{v:.1f}ms"
+    if metric.endswith("_per_response"):
+        return f"{v:.2f}"
+    return f"{v:.0f}"
+
+
+def print_table(rows):
+    widths = [max(len(str(r[i])) for r in rows) for i in range(len(rows[0]))]
+    for r in rows:
+        print("  ".join(str(c).rjust(w) for c, w in zip(r, widths)))
+
+
+def report_deltas(pairs, metrics, threshold, base_label, new_label,
+                  only_regressions=False):
+    """pairs: [(scenario label, base agg, new agg)], prints a table and
+    returns the number of regressions."""
+    table = [["mode", "payload", "conns", "engine", "metric", base_label,
+              new_label, "delta", ""]]
+    regressions = 0
+    for label, base, new in pairs:
+        for metric in metrics:
+            if metric not in base or metric not in new:
+                continue
+            d = delta_pct(base[metric], new[metric])
+            bad = is_regression(metric, d, threshold)
+            regressions += bad
+            if only_regressions and not bad:
+                continue
+            table.append(list(label) + [
+                metric, fmt_value(metric, base[metric]),
+                fmt_value(metric, new[metric]),
+                "-" if d is None else f"{d:+.1f}%",
+                "REGRESSION" if bad else ""])
+    if len(table) > 1:
+        print_table(table)
+    print(f"\n{regressions} regression(s) beyond {threshold}%")
+    return regressions
+
+
+def cmd_export(args):
+    rows = load(args.root)
+    out = open(args.out, "w", newline="", encoding="utf-8") \
+        if args.out else sys.stdout
+    if args.format == "json":
+        json.dump(rows, out, indent=2)
+        out.write("\n")
+    else:
+        w = csv.DictWriter(out, fieldnames=COLUMNS)
+        w.writeheader()
+        w.writerows(rows)
+    if args.out:
+        out.close()
+    return 0
+
+
+def cmd_compare(args):
+    agg = aggregate(load(args.root))
+    pairs = []
+    for key, base in sorted(agg.items()):
+        if key[3] != args.base:
+            continue
+        target = agg.get(key[:3] + (args.target,))
+        if target is not None:
+            pairs.append((key[:3] + (f"{args.base}->{args.target}",), base,
+                          target))
+    return 1 if report_deltas(pairs, args.metric, args.threshold, args.base,
+                              args.target, args.only_regressions) else 0
+
+
+def cmd_diff(args):
+    old = aggregate(load(args.old))
+    new = aggregate(load(args.new))
+    pairs = [(key, old[key], new[key]) for key in sorted(old) if key in new]
+    missing = sorted(set(old) ^ set(new))
+    for key in missing:
+        where = args.old if key in old else args.new
+        print(f"only in {where}: {' '.join(map(str, key))}", file=sys.stderr)
+    return 1 if report_deltas(pairs, args.metric, args.threshold, "old",
+                              "new", args.only_regressions) else 0
+
+
+def payload_label(n):
+    if n < 1024:
+        return str(n)
+    if n % 1024 == 0:
+        return f"{n // 1024}kb"
+    return f"{n // 1000}kb"
+
+
+def conns_label(n):
+    if n >= 1000 and n % 1000 == 0:
+        return f"{n // 1000}k-conns"
+    return f"{n}-conn" if n == 1 else f"{n}-conns"
+
+
+COLORS = ["#3366cc", "#dc3912", "#ff9900", "#109618", "#990099", "#0099c6"]
+
+
+def svg_chart(title, groups, engines, values, ylabel):
+    """Grouped bar chart in the style of the existing charts, values maps
+    (group, engine) to a number."""
+    width, height = 600, 380
+    left, right, top, bottom = 115, 486, 75, 315
+    vmax = max(values.values()) if values else 1
+    step = 10 ** math.floor(math.log10(vmax)) if vmax > 0 else 1
+    for mult in (1, 2, 2.5, 5, 10):
+        if vmax / (step * mult) <= 5:
+            step *= mult
+            break
+    ymax = step * math.ceil(vmax / step) if vmax > 0 else 1
+
+    def y(v):
+        return bottom - (bottom - top) * v / ymax
+
+    out = [f'<svg xmlns="http://www.w3.org/2000/svg" width="{width}" '
+           f'height="{height}" font-family="Arial" font-size="13">',
+           f'<rect width="{width}" height="{height}" fill="white"/>',
+           f'<text x="{left}" y="50" font-weight="bold">{title}</text>']
+    tick = 0.0
+    while tick <= ymax + step / 2:
+        out.append(f'<line x1="{left}" x2="{right}" y1="{y(tick):.1f}" '
+                   f'y2="{y(tick):.1f}" stroke="#ccc"/>')
+        out.append(f'<text x="{left - 13}" y="{y(tick) + 4:.1f}" '
+                   f'text-anchor="end" fill="#444">{tick:,.0f}</text>')
+        tick += step
+    out.append(f'<text transform="translate(28,{(top + bottom) / 2}) '
+               f'rotate(-90)" text-anchor="middle" font-style="italic">'
+               f'{ylabel}</text>')
+
+    slot = (right - left) / max(len(groups), 1)
+    bar = slot * 0.6 / max(len(engines), 1)
+    for gi, group in enumerate(groups):
+        x0 = left + gi * slot + slot * 0.2
+        for ei, engine in enumerate(engines):
+            v = values.get((group, engine))
+            if v is None:
+                continue
+            out.append(f'<rect x="{x0 + ei * bar:.1f}" y="{y(v):.1f}" '
+                       f'width="{bar - 1:.1f}" height="{bottom - y(v):.1f}" '
+                       f'fill="{COLORS[ei % len(COLORS)]}"/>')
+        out.append(f'<text x="{left + (gi + 0.5) * slot:.1f}" '
+                   f'y="{bottom + 18}" text-anchor="middle">'
+                   f'{conns_label(group)}</text>')
+    out.append(f'<line x1="{left}" x2="{right}" y1="{bottom}" y2="{bottom}" '
+               f'stroke="#333"/>')
+    out.append(f'<text x="{(left + right) / 2}" y="{bottom + 40}" '
+               f'text-anchor="middle" font-style="italic">conns</text>')
+
+    lx = (width - 110 * len(engines)) / 2
+    for ei, engine in enumerate(engines):
+        x = lx + ei * 110
+        out.append(f'<rect x="{x:.1f}" y="{height - 20}" width="26" '
+                   f'height="12" fill="{COLORS[ei % len(COLORS)]}"/>')
+        out.append(f'<text x="{x + 32:.1f}" y="{height - 9}">{engine}</text>')
+    out.append("</svg>\n")
+    return "\n".join(out)
+
+
+def cmd_charts(args):
+    agg = aggregate(load(args.root))
+    engines = args.engines.split(",") if args.engines else \
+        sorted({k[3] for k in agg})
+    scenarios = sorted({k[:2] for k in agg})
+    for mode, payload in scenarios:
+        groups = sorted({k[2] for k in agg if k[:2] == (mode, payload)})
+        values = {(k[2], k[3]): v[args.metric] for k, v in agg.items()
+                  if k[:2] == (mode, payload) and k[3] in engines and
+                  args.metric in v}
+        if not values:
+            continue
+        present = [e for e in engines if any(k[1] == e for k in values)]
+        label = payload_label(payload)
+        title = f"{payload} byte payload" + \
+            (" stream mode" if mode == "stream" else "")
+        name = label if mode == "stream" else f"{label}-req-res"
+        outdir = os.path.join(args.out or args.root, mode, str(payload))
+        os.makedirs(outdir, exist_ok=True)
+        path = os.path.join(outdir, f"{name}.svg")
+        with open(path, "w", encoding="utf-8") as f:
+            ylabel = "reqs/sec" if args.metric in (
+                "requests_per_sec", "responses_per_sec") else args.metric
+            f.write(svg_chart(title, groups, present, values, ylabel))
+        print(path)
+    return 0
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    sub = p.add_subparsers(dest="cmd", required=True)
+
+    e = sub.add_parser("export", help="dump every report as csv or json")
+    e.add_argument("--root", default="bench")
+    e.add_argument("--format", choices=["csv", "json"], default="csv")
+    e.add_argument("--out")
+    e.set_defaults(fn=cmd_export)
+
+    metric_help = "metric to compare, repeatable, default: " + \
+        ", ".join(DEFAULT_METRICS)
+    c = sub.add_parser("compare", help="engine vs engine within one tree")
+    c.add_argument("--root", default="bench")
+    c.add_argument("--base", default="epoll")
+    c.add_argument("--target", default="io_uring")
+    c.add_argument("--metric", action="append", choices=list(METRICS),
+                   help=metric_help)
+    c.add_argument("--threshold", type=float, default=5.0)
+    c.add_argument("--only-regressions", action="store_true")
+    c.set_defaults(fn=cmd_compare)
+
+    d = sub.add_parser("diff", help="same scenarios across two trees")
+    d.add_argument("old")
+    d.add_argument("new")
+    d.add_argument("--metric", action="append", choices=list(METRICS),
+                   help=metric_help)
+    d.add_argument("--threshold", type=float, default=5.0)
+    d.add_argument("--only-regressions", action="store_true")
+    d.set_defaults(fn=cmd_diff)
+
+    g = sub.add_parser("charts", help="regenerate the comparison charts")
+    g.add_argument("--root", default="bench")
+    g.add_argument("--out", help="write charts here instead of into --root")
+    g.add_argument("--engines", help="comma separated, default: all")
+    g.add_argument("--metric", choices=list(METRICS),
+                   default="responses_per_sec")
+    g.set_defaults(fn=cmd_charts)
+
+    args = p.parse_args()
+    if args.cmd in ("compare", "diff") and args.metric is None:
+        args.metric = DEFAULT_METRICS
+    return args.fn(args)
+
+
+if __name__ == "__main__":
+    signal.signal(signal.SIGPIPE, signal.SIG_DFL)  # e.g. piped into head
+    sys.exit(main())
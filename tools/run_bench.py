@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""Runs the benchmark matrix and writes the reports into the bench/ layout.
+
+Builds every engine and the load generator, then for each mode x payload x
+connection count x repetition starts one server pinned to --server-cpus,
+drives it with echo-client pinned to --client-cpus and, if perf is
+available, records the server's cycles, instructions, context switches,
+cache misses, dTLB misses and syscalls with perf stat next to the report:
+
+    bench/<mode>/<payload>/<conns>-conn/<engine>[.<rep>].txt
+    bench/<mode>/<payload>/<conns>-conn/<engine>[.<rep>].perf.csv
+
+Engines are given as name=make-target[:server args], the name ends up as the
+report's file name, e.g.
+
+    tools/run_bench.py --engine epoll=build-epoll \\
+        --engine "io_uring-zc=build-io_uring:-z 16384" \\
+        --modes req-res --payloads 256 --conns 8,512 --reps 3
+
+tools/benchdb.py reads both files back.
+"""
+
+import argparse
+import os
+import shlex
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+DEFAULT_ENGINES = ["epoll=build-epoll", "io_uring=build-io_uring"]
+DEFAULT_PAYLOADS = "256,512,1024,4096,8192,16384,32768,100000"
+DEFAULT_CONNS = "1,8,512,1000,10000"
+
+# perf stat events, the names are what benchdb.py expects in the csv
+PERF_EVENTS = ["cycles", "instructions", "context-switches", "cache-misses",
+               "dTLB-load-misses", "dTLB-store-misses",
+               "raw_syscalls:sys_enter"]
+
+
+def parse_cpus(s):
+    cpus = set()
+    for part in s.split(","):
+        lo, _, hi = part.partition("-")
+        cpus.update(range(int(lo), int(hi or lo) + 1))
+    return cpus
+
+
+def parse_engine(spec):
+    name, _, rest = spec.partition("=")
+    target, _, server_args = rest.partition(":")
+    if not name or not target:
+        sys.exit(f"invalid engine spec: {spec}")
+    return name, target, shlex.split(server_args)
+
+
+def run(cmd, dry_run, **kw):
+    print("+ " + " ".join(shlex.quote(c) for c in cmd), file=sys.stderr)
+    if not dry_run:
+        subprocess.run(cmd, check=True, cwd=ROOT, **kw)
+
+
+def build(engines, bin_dir, dry_run):
+    """Every make target writes ./server, each engine keeps its own copy."""
+    built = {}
+    for name, target, _ in engines:
+        dst = os.path.join(bin_dir, target)
+        if target not in built:
+            run(["make", "-s", target], dry_run)
+            if not dry_run:
+                os.makedirs(bin_dir, exist_ok=True)
+                shutil.move(os.path.join(ROOT, "server"), dst)
+            built[target] = dst
+    run(["make", "-s", "build-client"], dry_run)
+    if not dry_run:
+        shutil.move(os.path.join(ROOT, "echo-client"),
+                    os.path.join(bin_dir, "echo-client"))
+
+
+def wait_for_port(port, proc, timeout=10.0):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if proc.poll() is not None:
+            raise RuntimeError(f"server exited with {proc.returncode}")
+        try:
+            with socket.create_connection(("127.0.0.1", port), timeout=0.2):
+                return
+        except OSError:
+            time.sleep(0.1)
+    raise RuntimeError(f"server did not listen on port {port}")
+
+
+def cpu_time(pid):
+    """utime + stime of all threads of pid in seconds."""
+    with open(f"/proc/{pid}/stat", encoding="utf-8") as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def stop(proc, sig=signal.SIGTERM, timeout=10.0):
+    if proc is None or proc.poll() is not None:
+        return
+    proc.send_signal(sig)
+    try:
+        proc.wait(timeout)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+        proc.wait()
+
+
+def run_one(args, bin_dir, engine, mode, payload, conns, rep, perf):
+    name, target, server_args = engine
+    outdir = os.path.join(args.out, mode, str(payload), f"{conns}-conn")
+    stem = name if rep == 1 else f"{name}.{rep}"
+    report = os.path.join(outdir, f"{stem}.txt")
+    perf_out = os.path.join(outdir, f"{stem}.perf.csv")
+    if args.skip_existing and os.path.exists(report):
+        return
+
+    server_cmd = ["taskset", "-c", args.server_cpus,
+                  os.path.join(bin_dir, target), "-p", str(args.port)] + \
+        server_args
+    client_cmd = ["taskset", "-c", args.client_cpus,
+                  os.path.join(bin_dir, "echo-client"), "-p", str(args.port),
+                  "-m", mode, "-s", str(payload), "-c", str(conns), "-d",
+                  args.duration, "-t", str(args.client_threads)]
+    print(f"== {mode} {payload}B {conns} conns {stem}", file=sys.stderr)
+    print("+ " + " ".join(map(shlex.quote, server_cmd)), file=sys.stderr)
+    print("+ " + " ".join(map(shlex.quote, client_cmd)), file=sys.stderr)
+    if args.dry_run:
+        return
+
+    os.makedirs(outdir, exist_ok=True)
+    server = perf_proc = None
+    try:
+        server = subprocess.Popen(server_cmd, stdout=subprocess.DEVNULL,
+                                  stderr=subprocess.DEVNULL)
+        wait_for_port(args.port, server)
+        if perf:
+            perf_proc = subprocess.Popen(
+                ["perf", "stat", "-x,", "-e", ",".join(PERF_EVENTS), "-p",
+                 str(server.pid), "-o", perf_out],
+                stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        with open(report + ".tmp", "w", encoding="utf-8") as f:
+            cpu_start = cpu_time(server.pid)
+            subprocess.run(client_cmd, stdout=f, check=True)
+            # busy polling trades cpu for latency, the server's cpu time
+            # during the run is what the trade costs
+            f.write(f"{'server-cpu-time:':<29}"
+                    f"{cpu_time(server.pid) - cpu_start:.3f}s\n")
+        # perf stat writes its counts once interrupted
+        stop(perf_proc, signal.SIGINT)
+        os.replace(report + ".tmp", report)
+    finally:
+        stop(perf_proc, signal.SIGINT)
+        stop(server)
+        if os.path.exists(report + ".tmp"):
+            os.remove(report + ".tmp")
+    # let the sockets of the last run leave TIME_WAIT pressure behind
+    time.sleep(args.cooldown)
+
+
+def main():
+    p = argparse.ArgumentParser(
+        description=__doc__.split("\n")[0],
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog="\n".join(__doc__.split("\n")[2:]))
+    p.add_argument("--engine", action="append", metavar="NAME=TARGET[:ARGS]",
+                   help="engine to run, repeatable (default: epoll and "
+                        "io_uring)")
+    p.add_argument("--modes", default="stream,req-res")
+    p.add_argument("--payloads", default=DEFAULT_PAYLOADS)
+    p.add_argument("--conns", default=DEFAULT_CONNS)
+    p.add_argument("--reps", type=int, default=1)
+    p.add_argument("--duration", default="3m0s")
+    p.add_argument("--server-cpus", default="15")
+    p.add_argument("--client-cpus", default="8-11")
+    p.add_argument("--client-threads", type=int, default=4)
+    p.add_argument("--allow-overlap", action="store_true",
+                   help="allow server and client cpu sets to overlap")
+    p.add_argument("--port", type=int, default=9919)
+    p.add_argument("--out", default=os.path.join(ROOT, "bench"))
+    p.add_argument("--bin-dir", default=os.path.join(ROOT, ".bench-bin"))
+    p.add_argument("--skip-build", action="store_true",
+                   help="reuse the binaries in --bin-dir")
+    p.add_argument("--skip-existing", action="store_true",
+                   help="keep reports that are already there")
+    p.add_argument("--no-perf", action="store_true")
+    p.add_argument("--cooldown", type=float, default=2.0,
+                   help="seconds to wait between runs")
+    p.add_argument("--dry-run", action="store_true",
+                   help="print the commands without running them")
+    args = p.parse_args()
+
+    if not args.allow_overlap and \
+            parse_cpus(args.server_cpus) & parse_cpus(args.client_cpus):
+        sys.exit("server and client cpu sets overlap, see --allow-overlap")
+
+    engines = [parse_engine(e) for e in (args.engine or DEFAULT_ENGINES)]
+    perf = not args.no_perf and shutil.which("perf") is not None
+    if not args.no_perf and not perf:
+        print("perf not found, running without counters", file=sys.stderr)
+
+    if not args.skip_build:
+        build(engines, args.bin_dir, args.dry_run)
+
+    # repetitions are the outer loop so that a slow drift of the machine is
+    # spread across all scenarios instead of hitting one of them
+    failed = 0
+    for rep in range(1, args.reps + 1):
+        for mode in args.modes.split(","):
+            for payload in map(int, args.payloads.split(",")):
+                for conns in map(int, args.conns.split(",")):
+                    for engine in engines:
+                        try:
+                            run_one(args, args.bin_dir, engine, mode, payload,
+                                    conns, rep, perf)
+                        except (RuntimeError,
+                                subprocess.CalledProcessError) as e:
+                            # one broken scenario should not cost the rest of
+                            # a matrix that takes hours
+                            print(f"failed: {e}", file=sys.stderr)
+                            failed += 1
+    if failed:
+        print(f"{failed} run(s) failed", file=sys.stderr)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())